@@ -3,6 +3,7 @@
 #include <cstring>
 #include <cassert>
 #include <cstdio>
+#include "strsearch61.hh"
 
 char* mystrstr(const char* s1, const char* s2) {
     // loop over `s1`
@@ -34,5 +35,10 @@ int main(int argc, char** argv) {
            argv[1], argv[2], strstr(argv[1], argv[2]));
     printf("mystrstr(\"%s\", \"%s\") = %p\n",
            argv[1], argv[2], mystrstr(argv[1], argv[2]));
+    printf("strstr61(\"%s\", \"%s\") = %p\n",
+           argv[1], argv[2], strstr61(argv[1], argv[2]));
     assert(strstr(argv[1], argv[2]) == mystrstr(argv[1], argv[2]));
+    assert(strstr(argv[1], argv[2]) == strstr61(argv[1], argv[2]));
 }
+
+//$ c++ -std=gnu++1z -Wall -g -O3 2strstr61.cc strsearch61.cc -o 2strstr61
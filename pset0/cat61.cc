@@ -3,6 +3,52 @@
 #include <cstring>
 #include <cstdlib>
 #include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+//largest amount the kernel moves per system call
+static const size_t KERNEL_CHUNK = 1 << 30;
+//buffer for copies the kernel cannot do, page-aligned
+static const size_t BUFFER_SIZE = 1 << 20;
+alignas(4096) static char buf[BUFFER_SIZE];
+
+//move the rest of infd to outfd inside the kernel: copy_file_range
+//between regular files, splice if either end is a pipe, sendfile from a
+//regular file to anything else. returns false if the kernel can't (or
+//can't go on), and the caller copies the rest itself
+static bool kernel_copy(int infd, int outfd) {
+  struct stat ist, ost;
+  if (fstat(infd, &ist) < 0 || fstat(outfd, &ost) < 0) {
+    return false;
+  }
+  bool inreg = S_ISREG(ist.st_mode), outreg = S_ISREG(ost.st_mode);
+  bool pipe = S_ISFIFO(ist.st_mode) || S_ISFIFO(ost.st_mode);
+  //files in /proc and /sys claim size 0 but do have contents
+  if (inreg && ist.st_size == 0) {
+    return false;
+  }
+
+  while (true) {
+    ssize_t r;
+    if (inreg && outreg) {
+      r = copy_file_range(infd, nullptr, outfd, nullptr, KERNEL_CHUNK, 0);
+    } else if (pipe) {
+      r = splice(infd, nullptr, outfd, nullptr, KERNEL_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+    } else if (inreg) {
+      r = sendfile(outfd, infd, nullptr, KERNEL_CHUNK);
+    } else {
+      return false;
+    }
+    if (r == 0) {
+      return true;
+    } else if (r < 0 && errno != EINTR) {
+      return false; //EINVAL, EXDEV, ENOSYS...: fall back
+    }
+  }
+}
 
 static void transfer(const char* filename) {
   //open input file
@@ -17,11 +63,15 @@ static void transfer(const char* filename) {
     exit(1);
   }
 
-  //transfer data until EOF or error
-  while (!feof(in) && !ferror(in) && !ferror(stdout)) {
-    char buf[BUFSIZ];
-    size_t nr = fread(buf, 1, BUFSIZ, in);
-    (void) fwrite(buf, 1, nr, stdout);
+  //stdout's buffer must go out before the kernel writes behind its back
+  fflush(stdout);
+
+  //transfer data until EOF or error; a large fread skips stdio's own buffer
+  if (ferror(stdout) || !kernel_copy(fileno(in), fileno(stdout))) {
+    while (!feof(in) && !ferror(in) && !ferror(stdout)) {
+      size_t nr = fread(buf, 1, BUFFER_SIZE, in);
+      (void) fwrite(buf, 1, nr, stdout);
+    }
   }
 
   //exit on error
@@ -0,0 +1,164 @@
+#include "multisearch61.hh"
+#include <cstring>
+#include <deque>
+
+// While compiling, the trie is kept with one row of child states per node,
+// indexed by byte class, with 0 meaning no child (the root is never a
+// child). Rows are then filled in into the transition table, which is
+// finally reordered.
+
+
+/// multisearch61_compile(ms, patterns, lengths, n)
+///    Compile the patterns into an Aho-Corasick automaton.
+
+void multisearch61_compile(multisearch61* ms, const char* const* patterns,
+                           const size_t* lengths, size_t n) {
+    ms->lengths.assign(lengths, lengths + n);
+
+    // byte classes: 0 for bytes in no pattern
+    memset(ms->byte_class, 0, sizeof(ms->byte_class));
+    size_t nclasses = 1;
+    for (size_t p = 0; p != n; ++p) {
+        for (size_t i = 0; i != lengths[p]; ++i) {
+            unsigned char c = patterns[p][i];
+            if (!ms->byte_class[c]) {
+                ms->byte_class[c] = nclasses++;
+            }
+        }
+    }
+    ms->nclasses = nclasses;
+
+    // the trie; states are numbered 0, 1, 2, ... until the end
+    std::vector<uint32_t>& t = ms->transitions;
+    t.assign(nclasses, 0);
+    ms->first_match.assign(1, -1);
+    ms->next_match.assign(n, -1);
+    size_t nstates = 1;
+    for (size_t p = 0; p != n; ++p) {
+        if (lengths[p] == 0) {
+            continue;
+        }
+        uint32_t s = 0;
+        for (size_t i = 0; i != lengths[p]; ++i) {
+            uint32_t& child = t[s * nclasses + ms->byte_class[(unsigned char) patterns[p][i]]];
+            if (!child) {
+                child = nstates++;
+                t.resize(nstates * nclasses, 0);
+                ms->first_match.push_back(-1);
+            }
+            s = t[s * nclasses + ms->byte_class[(unsigned char) patterns[p][i]]];
+        }
+        // keep the list of patterns ending at `s` in pattern order
+        int32_t* link = &ms->first_match[s];
+        while (*link >= 0) {
+            link = &ms->next_match[*link];
+        }
+        *link = p;
+    }
+
+    // breadth-first, turn each missing child into the transition its
+    // failure state takes. Also note which states end a pattern, directly
+    // or through their failure chain, and where that chain's matches are.
+    std::vector<uint32_t> fail(nstates, 0);
+    std::vector<int32_t> dict(nstates, -1);     // nearest matching suffix state
+    std::vector<bool> matches(nstates, false);
+    std::deque<uint32_t> queue;
+    for (size_t c = 0; c != nclasses; ++c) {
+        if (uint32_t child = t[c]) {
+            queue.push_back(child);
+        }
+    }
+    while (!queue.empty()) {
+        uint32_t s = queue.front();
+        queue.pop_front();
+        uint32_t f = fail[s];
+        dict[s] = ms->first_match[f] >= 0 ? (int32_t) f : dict[f];
+        matches[s] = ms->first_match[s] >= 0 || dict[s] >= 0;
+        for (size_t c = 0; c != nclasses; ++c) {
+            uint32_t& child = t[s * nclasses + c];
+            if (child) {
+                fail[child] = t[f * nclasses + c];
+                queue.push_back(child);
+            } else {
+                child = t[f * nclasses + c];
+            }
+        }
+    }
+
+    // renumber the states so the matching ones come last; then a scan
+    // tells a match by comparing the state, off the critical path
+    std::vector<uint32_t> renumber(nstates);
+    uint32_t nplain = 0;
+    for (uint32_t s = 0; s != nstates; ++s) {
+        nplain += !matches[s];
+    }
+    for (uint32_t s = 0, plain = 0, matching = nplain; s != nstates; ++s) {
+        renumber[s] = matches[s] ? matching++ : plain++;
+    }
+    std::vector<uint32_t> table(nstates * nclasses);
+    for (uint32_t s = 0; s != nstates; ++s) {
+        for (size_t c = 0; c != nclasses; ++c) {
+            table[renumber[s] * nclasses + c] = renumber[t[s * nclasses + c]] * nclasses;
+        }
+    }
+    t = std::move(table);
+    ms->first_matching_state = nplain * nclasses;
+
+    // fold the failure chain's matches into each matching state's list, so
+    // a scan only ever looks at one list
+    std::vector<int32_t> chain;
+    std::vector<int32_t> first(nstates - nplain, -1);
+    std::vector<int32_t> next;
+    std::vector<int32_t> pattern;
+    for (uint32_t s = 0; s != nstates; ++s) {
+        if (!matches[s]) {
+            continue;
+        }
+        int32_t& head = first[renumber[s] - nplain];
+        for (int32_t d = s; d >= 0; d = dict[d]) {
+            for (int32_t p = ms->first_match[d]; p >= 0; p = ms->next_match[p]) {
+                chain.push_back(p);
+            }
+        }
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            pattern.push_back(*it);
+            next.push_back(head);
+            head = pattern.size() - 1;
+        }
+        chain.clear();
+    }
+    ms->first_match = std::move(first);
+    ms->next_match = std::move(next);
+    ms->match_pattern = std::move(pattern);
+}
+
+
+/// multisearch61_scan(ms, stream, text, n, report, arg)
+///    Scan `text[0..n)` and report every match.
+
+size_t multisearch61_scan(const multisearch61* ms, multisearch61_stream* stream,
+                          const char* text, size_t n,
+                          void (*report)(size_t pattern, size_t offset, void* arg),
+                          void* arg) {
+    const uint32_t* t = ms->transitions.data();
+    const uint16_t* byte_class = ms->byte_class;
+    const unsigned char* p = (const unsigned char*) text;
+    uint32_t first_matching = ms->first_matching_state;
+    uint32_t s = stream->state;
+    size_t nmatches = 0;
+    for (size_t i = 0; i != n; ++i) {
+        s = t[s + byte_class[p[i]]];
+        if (s >= first_matching) {
+            size_t end = stream->offset + i + 1;
+            size_t row = (s - first_matching) / ms->nclasses;
+            for (int32_t m = ms->first_match[row]; m >= 0; m = ms->next_match[m]) {
+                size_t pat = ms->match_pattern[m];
+                report(pat, end - ms->lengths[pat], arg);
+                ++nmatches;
+            }
+        }
+    }
+    stream->state = s;
+    stream->offset += n;
+    return nmatches;
+}
@@ -0,0 +1,60 @@
+#ifndef MULTISEARCH61_HH
+#define MULTISEARCH61_HH
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// multisearch61: find every occurrence of many patterns in one pass.
+//
+// A pattern set is compiled into an Aho-Corasick automaton with a dense
+// transition table, so scanning costs one table lookup per text byte no
+// matter how many patterns there are. To keep the table small, bytes are
+// first mapped to classes: every byte that appears in no pattern shares
+// class 0, so a row has one entry per distinct pattern byte, plus one.
+//
+// Text can be scanned in pieces; matches that span pieces are found, and
+// offsets count from the start of the first piece. The number of states
+// times the number of classes must stay below 2^32.
+
+struct multisearch61 {
+    std::vector<size_t> lengths;            // of each pattern
+    size_t nclasses;
+    uint16_t byte_class[256];
+    // transitions[s + class] is the state after state `s` reads a byte of
+    // that class. States are numbered by the offset of their row, and the
+    // states where some pattern ends come last, from first_matching_state.
+    std::vector<uint32_t> transitions;
+    uint32_t first_matching_state;
+    // the patterns ending at each matching state (by row number, counting
+    // from first_matching_state), longest first: match_pattern[m] for
+    // m = first_match[row], next_match[m], ... until -1
+    std::vector<int32_t> first_match;
+    std::vector<int32_t> next_match;
+    std::vector<int32_t> match_pattern;
+};
+
+struct multisearch61_stream {
+    uint32_t state = 0;
+    size_t offset = 0;                      // bytes scanned so far
+};
+
+/// multisearch61_compile(ms, patterns, lengths, n)
+///    Compile the `n` patterns, the ith of which has `lengths[i]` bytes at
+///    `patterns[i]`, into `*ms`. Empty patterns never match. Takes time
+///    proportional to the total pattern length times the number of byte
+///    classes.
+void multisearch61_compile(multisearch61* ms, const char* const* patterns,
+                           const size_t* lengths, size_t n);
+
+/// multisearch61_scan(ms, stream, text, n, report, arg)
+///    Scan the `n` bytes at `text`, continuing `*stream`, and call
+///    `report(pattern, offset, arg)` for every match, where `pattern` is the
+///    index of the matching pattern and `offset` is where the match starts.
+///    Matches are reported in order of their end. Returns the number of
+///    matches.
+size_t multisearch61_scan(const multisearch61* ms, multisearch61_stream* stream,
+                          const char* text, size_t n,
+                          void (*report)(size_t pattern, size_t offset, void* arg),
+                          void* arg);
+
+#endif
@@ -0,0 +1,456 @@
+//sort61: sort lines, in parallel and out of core
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// sort61 [-S BYTES] [-j THREADS] [-T TMPDIR] [FILE...]
+//    Print the lines of the FILEs, or of stdin, sorted by bytes (like
+//    `LC_ALL=C sort`).
+//
+//    Files are mapped, and lines are sorted as string views into the map,
+//    so no line is copied until it is printed; stdin and other unmappable
+//    inputs are read into memory first. Lines are sorted by MSD radix sort
+//    on one byte at a time: the biggest buckets are split up first, and
+//    then the buckets are sorted by THREADS threads (default: one per core).
+//    Buckets still unsorted after 64 partitions are sorted by comparison.
+//    sort61test.sh checks the result against `sort`.
+//
+//    Input that takes more than BYTES of memory (default 1G; K, M and G
+//    suffixes work) is sorted in batches of at most BYTES each. Each batch
+//    is written to a temporary file in TMPDIR (default $TMPDIR or /tmp) as
+//    a sorted run, and the runs are merged at the end. A line costs its
+//    length plus 32 bytes for its view and the radix sort's scratch view.
+
+using line = std::string_view;
+
+static size_t nthreads;
+static size_t budget = (size_t) 1 << 30;
+static const char* tmpdir;
+
+const size_t LINE_OVERHEAD = 2 * sizeof(line);
+// Buckets smaller than this are sorted by comparison.
+const size_t SMALL_SORT = 32;
+// Buckets that have been partitioned this many times are sorted by
+// comparison.
+const size_t MAX_ROUNDS = 64;
+
+
+[[noreturn]] static void fail(const char* what) {
+    fprintf(stderr, "sort61: %s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+
+// Output through a big buffer.
+
+struct writer {
+    int fd;
+    std::vector<char> buf = std::vector<char>(1 << 20);
+    size_t n = 0;
+
+    explicit writer(int fd_)
+        : fd(fd_) {
+    }
+    void flush() {
+        for (size_t off = 0; off != n; ) {
+            ssize_t nw = write(fd, buf.data() + off, n - off);
+            if (nw < 0 && errno != EINTR) {
+                fail("write");
+            } else if (nw > 0) {
+                off += nw;
+            }
+        }
+        n = 0;
+    }
+    void put(line s) {
+        if (n + s.size() + 1 > buf.size()) {
+            flush();
+            if (s.size() + 1 > buf.size()) {
+                buf.resize(s.size() + 1);
+            }
+        }
+        memcpy(buf.data() + n, s.data(), s.size());
+        n += s.size();
+        buf[n++] = '\n';
+    }
+};
+
+
+// Radix sort.
+
+// key(s, depth)
+//    The bucket of `s` at `depth`: 0 if it is that short, otherwise 1 plus
+//    its byte there.
+static inline size_t key(line s, size_t depth) {
+    return s.size() > depth ? 1 + (unsigned char) s[depth] : 0;
+}
+
+// partition(a, n, depth, tmp, start)
+//    Move the lines `a[0..n)`, which agree on their first `depth` bytes,
+//    into buckets by their byte at `depth`, using `tmp[0..n)` as scratch.
+//    Bucket k ends up at `a[start[k]..start[k+1])`.
+static void partition(line* a, size_t n, size_t depth, line* tmp, size_t start[258]) {
+    size_t count[257] = {};
+    for (size_t i = 0; i != n; ++i) {
+        ++count[key(a[i], depth)];
+    }
+    start[0] = 0;
+    for (size_t k = 0; k != 257; ++k) {
+        start[k + 1] = start[k] + count[k];
+    }
+    size_t next[257];
+    std::copy(start, start + 257, next);
+    for (size_t i = 0; i != n; ++i) {
+        tmp[next[key(a[i], depth)]++] = a[i];
+    }
+    std::copy(tmp, tmp + n, a);
+}
+
+// largest_bucket(start)
+//    The nonempty-line bucket with the most lines.
+static size_t largest_bucket(const size_t start[258]) {
+    size_t big = 1;
+    for (size_t k = 2; k != 257; ++k) {
+        if (start[k + 1] - start[k] > start[big + 1] - start[big]) {
+            big = k;
+        }
+    }
+    return big;
+}
+
+// radix_sort(a, n, depth, tmp, rounds)
+//    Sort the lines `a[0..n)`, which agree on their first `depth` bytes and
+//    have been through `rounds` partitions. Only the smaller buckets are
+//    sorted recursively, so the stack stays shallow, and after MAX_ROUNDS
+//    partitions the rest is sorted by comparison: lines that are prefixes
+//    of each other would otherwise cost a partition per byte.
+static void radix_sort(line* a, size_t n, size_t depth, line* tmp, size_t rounds) {
+    while (n >= SMALL_SORT && rounds < MAX_ROUNDS) {
+        // skip bytes that all lines share, without moving them
+        size_t k0 = key(a[0], depth);
+        size_t i = 1;
+        while (i != n && key(a[i], depth) == k0) {
+            ++i;
+        }
+        if (i == n) {
+            if (k0 == 0) {
+                return;         // all equal
+            }
+            ++depth;
+            continue;
+        }
+
+        size_t start[258];
+        partition(a, n, depth, tmp, start);
+        ++rounds;
+        size_t big = largest_bucket(start);
+        for (size_t k = 1; k != 257; ++k) {
+            if (k != big) {
+                radix_sort(a + start[k], start[k + 1] - start[k], depth + 1, tmp + start[k], rounds);
+            }
+        }
+        a += start[big];
+        tmp += start[big];
+        n = start[big + 1] - start[big];
+        ++depth;
+    }
+    std::sort(a, a + n, [depth] (line x, line y) {
+        return x.substr(depth) < y.substr(depth);
+    });
+}
+
+struct sort_task {
+    line* a;
+    size_t n;
+    size_t depth;
+    size_t rounds;
+};
+
+// split(a, n, depth, tmp, rounds, limit, tasks)
+//    Partition `a[0..n)` until every bucket has at most `limit` lines, or
+//    has been through MAX_ROUNDS partitions, and add the buckets to
+//    `tasks`.
+static void split(line* a, size_t n, size_t depth, line* tmp, size_t rounds,
+                  size_t limit, std::vector<sort_task>& tasks) {
+    while (n > limit && n >= SMALL_SORT && rounds < MAX_ROUNDS) {
+        size_t start[258];
+        partition(a, n, depth, tmp, start);
+        size_t big = largest_bucket(start);
+        if (start[big + 1] - start[big] != n) {
+            ++rounds;           // a shared byte doesn't count
+        }
+        for (size_t k = 1; k != 257; ++k) {
+            if (k != big) {
+                split(a + start[k], start[k + 1] - start[k], depth + 1, tmp + start[k],
+                      rounds, limit, tasks);
+            }
+        }
+        a += start[big];
+        tmp += start[big];
+        n = start[big + 1] - start[big];
+        ++depth;
+    }
+    tasks.push_back({a, n, depth, rounds});
+}
+
+// parallel_sort(lines)
+//    Sort `lines` with `nthreads` threads.
+static void parallel_sort(std::vector<line>& lines) {
+    std::vector<line> tmp(lines.size());
+    if (nthreads <= 1) {
+        radix_sort(lines.data(), lines.size(), 0, tmp.data(), 0);
+        return;
+    }
+
+    std::vector<sort_task> tasks;
+    split(lines.data(), lines.size(), 0, tmp.data(), 0,
+          std::max(lines.size() / (4 * nthreads), (size_t) 1 << 14), tasks);
+    std::sort(tasks.begin(), tasks.end(), [] (const sort_task& x, const sort_task& y) {
+        return x.n > y.n;
+    });
+    std::atomic<size_t> next(0);
+    auto worker = [&] {
+        for (size_t i; (i = next++) < tasks.size(); ) {
+            sort_task& t = tasks[i];
+            radix_sort(t.a, t.n, t.depth, tmp.data() + (t.a - lines.data()), t.rounds);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < nthreads; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& th : threads) {
+        th.join();
+    }
+}
+
+
+// Input. Lines are collected into a batch until it reaches the budget.
+// Mapped files stay mapped until the end; batches of stdin are read into
+// buffers that are freed once the batch is written out.
+
+static std::vector<line> batch;
+static size_t batch_bytes;
+static std::vector<std::vector<char>> batch_buffers;
+static std::vector<int> runs;           // temporary files of sorted runs
+
+// spill()
+//    Sort the batch and write it to a new run.
+static void spill() {
+    parallel_sort(batch);
+    std::string name = std::string(tmpdir) + "/sort61.XXXXXX";
+    int fd = mkstemp(&name[0]);
+    if (fd < 0) {
+        fail(name.c_str());
+    }
+    unlink(name.c_str());
+    writer w(fd);
+    for (line s : batch) {
+        w.put(s);
+    }
+    w.flush();
+    runs.push_back(fd);
+    batch.clear();
+    batch_bytes = 0;
+    batch_buffers.clear();
+}
+
+// add_lines(p, n)
+//    Add the lines in `p[0..n)` to the batch. A missing final newline is
+//    implied. Spills full batches.
+static void add_lines(const char* p, size_t n) {
+    const char* end = p + n;
+    while (p != end) {
+        const char* nl = (const char*) memchr(p, '\n', end - p);
+        const char* e = nl ? nl : end;
+        if (batch_bytes + (e - p) + LINE_OVERHEAD > budget && !batch.empty()) {
+            spill();
+        }
+        batch.emplace_back(p, e - p);
+        batch_bytes += (e - p) + LINE_OVERHEAD;
+        p = nl ? nl + 1 : end;
+    }
+}
+
+// add_file(fd, name)
+//    Add the lines of `fd`: mapped if possible, otherwise read in pieces.
+static void add_file(int fd, const char* name) {
+    struct stat st;
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && pos >= 0 && st.st_size > pos) {
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_WILLNEED);
+            add_lines((const char*) map + pos, st.st_size - pos);
+            return;     // never unmapped: batches may point into it
+        }
+    }
+
+    // read pieces of a quarter of the budget, keeping any partial line at
+    // the end of a piece for the next one; at end of file, the partial
+    // line is the last line
+    size_t piece = std::max(budget / 4, (size_t) 1 << 16);
+    std::string partial;
+    while (true) {
+        std::vector<char> buf(partial.size() + piece);
+        memcpy(buf.data(), partial.data(), partial.size());
+        size_t n = partial.size();
+        while (n != buf.size()) {
+            ssize_t nr = read(fd, buf.data() + n, buf.size() - n);
+            if (nr == 0) {
+                break;
+            } else if (nr < 0 && errno != EINTR) {
+                fail(name);
+            } else if (nr > 0) {
+                n += nr;
+            }
+        }
+        if (n == 0) {
+            return;
+        }
+        bool eof = n != buf.size();
+        size_t complete = n;
+        if (!eof) {
+            const char* nl = (const char*) memrchr(buf.data(), '\n', n);
+            complete = nl ? nl + 1 - buf.data() : 0;
+        }
+        partial.assign(buf.data() + complete, n - complete);
+        buf.resize(complete);
+        add_lines(buf.data(), complete);
+        if (!buf.empty()) {
+            batch_buffers.push_back(std::move(buf));
+        }
+        if (eof) {
+            return;
+        }
+    }
+}
+
+
+// Output.
+
+// merge_runs(out)
+//    Merge the sorted runs into `out`.
+static void merge_runs(writer& out) {
+    struct cursor {
+        const char* p;
+        const char* end;
+        line cur;
+    };
+    std::vector<cursor> cursors;
+    for (int fd : runs) {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            fail("run");
+        }
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            fail("run");
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        const char* p = (const char*) map;
+        cursors.push_back({p, p + st.st_size, line()});
+    }
+    // advance(c): read the next line of `c`, or return false at its end
+    auto advance = [] (cursor& c) {
+        if (c.p == c.end) {
+            return false;
+        }
+        const char* nl = (const char*) memchr(c.p, '\n', c.end - c.p);
+        c.cur = line(c.p, nl - c.p);
+        c.p = nl + 1;
+        return true;
+    };
+    auto greater = [&] (size_t i, size_t j) {
+        return cursors[i].cur > cursors[j].cur;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(greater);
+    for (size_t i = 0; i != cursors.size(); ++i) {
+        if (advance(cursors[i])) {
+            heap.push(i);
+        }
+    }
+    while (!heap.empty()) {
+        size_t i = heap.top();
+        heap.pop();
+        out.put(cursors[i].cur);
+        if (advance(cursors[i])) {
+            heap.push(i);
+        }
+    }
+}
+
+static size_t parse_size(const char* s) {
+    char* end;
+    unsigned long long n = strtoull(s, &end, 0);
+    switch (*end) {
+    case 'G': case 'g':
+        n <<= 10;
+        // fallthrough
+    case 'M': case 'm':
+        n <<= 10;
+        // fallthrough
+    case 'K': case 'k':
+        n <<= 10;
+        break;
+    }
+    return n;
+}
+
+int main(int argc, char** argv) {
+    nthreads = std::max(std::thread::hardware_concurrency(), 1U);
+    tmpdir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    int opt;
+    while ((opt = getopt(argc, argv, "S:j:T:")) != -1) {
+        if (opt == 'S') {
+            budget = std::max(parse_size(optarg), (size_t) 1 << 16);
+        } else if (opt == 'j') {
+            nthreads = std::max(atoi(optarg), 1);
+        } else if (opt == 'T') {
+            tmpdir = optarg;
+        } else {
+            fprintf(stderr, "Usage: sort61 [-S BYTES] [-j THREADS] [-T TMPDIR] [FILE...]\n");
+            exit(1);
+        }
+    }
+
+    if (optind == argc) {
+        add_file(STDIN_FILENO, "-");
+    }
+    for (int i = optind; i < argc; ++i) {
+        int fd = strcmp(argv[i], "-") == 0 ? STDIN_FILENO : open(argv[i], O_RDONLY);
+        if (fd < 0) {
+            fail(argv[i]);
+        }
+        add_file(fd, argv[i]);
+    }
+
+    writer out(STDOUT_FILENO);
+    if (runs.empty()) {
+        parallel_sort(batch);
+        for (line s : batch) {
+            out.put(s);
+        }
+    } else {
+        if (!batch.empty()) {
+            spill();
+        }
+        merge_runs(out);
+    }
+    out.flush();
+}
+
+//$ c++ -std=gnu++1z -Wall -g -O3 -pthread sort61.cc -o sort61
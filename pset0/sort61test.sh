@@ -0,0 +1,34 @@
+#!/bin/sh
+# sort61test.sh [SORT61]
+#    Check sort61 (default ./sort61) against `LC_ALL=C sort` on inputs that
+#    have broken it before, with one thread, several threads, and batches
+#    small enough to spill.
+
+sort61=${1:-./sort61}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+status=0
+
+# nested prefixes: "a", "aa", ..., 6000 "a"s (about 18 MB). Every byte
+# splits off one line, which once recursed 6000 deep and overflowed the
+# stack.
+awk 'BEGIN { s = ""; for (i = 0; i < 6000; ++i) { s = s "a"; print s } }' |
+    awk 'BEGIN { srand(61) } { print rand() "\t" $0 }' | sort | cut -f2- > "$dir/prefixes"
+
+# the same lines sharing a long prefix, plus ordinary words
+awk '{ print "https://example.com/" $0 }' "$dir/prefixes" > "$dir/urls"
+awk 'BEGIN { srand(6) } { for (i = 0; i < 100000; ++i) printf "%x\n", rand() * 4294967296 }' \
+    < /dev/null > "$dir/words"
+
+for f in prefixes urls words; do
+    LC_ALL=C sort "$dir/$f" > "$dir/expected"
+    for args in "-j1" "-j4" "-j4 -S64K"; do
+        if ! $sort61 $args -T "$dir" "$dir/$f" > "$dir/out" \
+           || ! cmp -s "$dir/out" "$dir/expected"; then
+            echo "sort61test: $f, $args: FAIL" 1>&2
+            status=1
+        fi
+    done
+done
+[ $status = 0 ] && echo "sort61test: OK"
+exit $status
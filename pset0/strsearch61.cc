@@ -0,0 +1,284 @@
+#include "strsearch61.hh"
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Needles up to this long use the SIMD filter.
+const size_t SIMD_MAX = 16;
+// Needles up to this long, with at least HORSPOOL_DISTINCT distinct bytes,
+// use Horspool.
+const size_t HORSPOOL_MAX = 256;
+const int HORSPOOL_DISTINCT = 8;
+// Horspool gives up once it compared more than this many bytes per byte it
+// skipped past.
+const size_t HORSPOOL_BUDGET = 4;
+
+
+// max_suffix(x, m, reverse, period)
+//    Return the start of the maximal suffix of `x` under byte order, or the
+//    reverse order if `reverse` is true, and store its period in `*period`.
+
+static size_t max_suffix(const unsigned char* x, size_t m, bool reverse, size_t* period) {
+    // `ms + 1` is the start of the best suffix so far; it starts at -1
+    size_t ms = (size_t) -1, j = 0, k = 1, p = 1;
+    while (j + k < m) {
+        unsigned char a = x[j + k], b = x[ms + k];
+        if (reverse ? a > b : a < b) {
+            j += k;
+            k = 1;
+            p = j - ms;
+        } else if (a == b) {
+            if (k != p) {
+                ++k;
+            } else {
+                j += p;
+                k = 1;
+            }
+        } else {
+            ms = j;
+            j = ms + 1;
+            k = p = 1;
+        }
+    }
+    *period = p;
+    return ms + 1;
+}
+
+// twoway_prepare(s)
+//    Compute the critical factorization of the needle for Two-Way.
+
+static void twoway_prepare(strsearch61* s) {
+    size_t p1, p2;
+    size_t c1 = max_suffix(s->needle, s->m, false, &p1);
+    size_t c2 = max_suffix(s->needle, s->m, true, &p2);
+    s->crit = c1 > c2 ? c1 : c2;
+    s->period = c1 > c2 ? p1 : p2;
+    // the needle is periodic if its left half repeats one period later
+    s->periodic = s->crit + s->period <= s->m
+        && memcmp(s->needle, s->needle + s->period, s->crit) == 0;
+    if (!s->periodic) {
+        s->period = std::max(s->crit, s->m - s->crit) + 1;
+    }
+}
+
+// twoway_find(s, y, n)
+//    Two-Way search for the needle in `y[0..n)`. Windows whose last byte
+//    does not match are skipped with the Horspool shift first. Returns the
+//    offset of the first match, or `n` if there is none.
+
+static size_t twoway_find(const strsearch61* s, const unsigned char* y, size_t n) {
+    const unsigned char* x = s->needle;
+    size_t m = s->m, crit = s->crit;
+    unsigned char last = x[m - 1];
+    size_t memory = 0;          // bytes at the window start known to match
+    for (size_t j = 0; n >= m && j <= n - m; ) {
+        // skip windows whose last byte is wrong, as in Horspool, if that
+        // beats the one-byte shift of a mismatch at the critical position
+        unsigned char c = y[j + m - 1];
+        if (c != last && s->shift[c] > 1) {
+            j += s->shift[c];
+            memory = 0;
+            continue;
+        }
+        // compare the right half left to right
+        size_t i = std::max(crit, memory);
+        while (i < m && x[i] == y[j + i]) {
+            ++i;
+        }
+        if (i < m) {
+            j += i - crit + 1;
+            memory = 0;
+            continue;
+        }
+        // then the left half right to left
+        i = crit;
+        while (i > memory && x[i - 1] == y[j + i - 1]) {
+            --i;
+        }
+        if (i <= memory) {
+            return j;
+        }
+        j += s->period;
+        memory = s->periodic ? m - s->period : 0;
+    }
+    return n;
+}
+
+
+// horspool_find(s, y, n)
+//    Horspool search for the needle in `y[0..n)`. Switches to Two-Way
+//    when candidates keep almost matching. Returns the offset of the first
+//    match, or `n` if there is none.
+
+static size_t horspool_find(const strsearch61* s, const unsigned char* y, size_t n) {
+    const unsigned char* x = s->needle;
+    size_t m = s->m;
+    unsigned char last = x[m - 1];
+    size_t work = 0;
+    for (size_t j = 0; n >= m && j <= n - m; ) {
+        unsigned char c = y[j + m - 1];
+        if (c == last) {
+            if (memcmp(y + j, x, m - 1) == 0) {
+                return j;
+            }
+            work += m;
+            if (work > HORSPOOL_BUDGET * j + 4 * m) {
+                return j + twoway_find(s, y + j, n - j);
+            }
+        }
+        j += s->shift[c];
+    }
+    return n;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+// simd_find_sse2(s, y, n), simd_find_avx2(s, y, n)
+//    Search for a needle of 2 to SIMD_MAX bytes in `y[0..n)` by comparing
+//    its first and last bytes at a block of positions at once, and then
+//    checking the positions where both match. Returns the offset of the
+//    first match, or `n` if there is none.
+
+static size_t simd_find_tail(const strsearch61* s, const unsigned char* y, size_t n, size_t j) {
+    for (; j + s->m <= n; ++j) {
+        if (y[j] == s->needle[0] && memcmp(y + j + 1, s->needle + 1, s->m - 1) == 0) {
+            return j;
+        }
+    }
+    return n;
+}
+
+__attribute__((target("sse2")))
+static size_t simd_find_sse2(const strsearch61* s, const unsigned char* y, size_t n) {
+    const unsigned char* x = s->needle;
+    size_t m = s->m;
+    const __m128i first = _mm_set1_epi8(x[0]), last = _mm_set1_epi8(x[m - 1]);
+    size_t j = 0;
+    for (; j + m - 1 + 16 <= n; j += 16) {
+        __m128i f = _mm_loadu_si128((const __m128i*) (y + j));
+        __m128i l = _mm_loadu_si128((const __m128i*) (y + j + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(f, first),
+                                                        _mm_cmpeq_epi8(l, last)));
+        while (mask) {
+            size_t k = j + __builtin_ctz(mask);
+            if (memcmp(y + k + 1, x + 1, m - 2) == 0) {
+                return k;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return simd_find_tail(s, y, n, j);
+}
+
+__attribute__((target("avx2")))
+static size_t simd_find_avx2(const strsearch61* s, const unsigned char* y, size_t n) {
+    const unsigned char* x = s->needle;
+    size_t m = s->m;
+    const __m256i first = _mm256_set1_epi8(x[0]), last = _mm256_set1_epi8(x[m - 1]);
+    size_t j = 0;
+    for (; j + m - 1 + 32 <= n; j += 32) {
+        __m256i f = _mm256_loadu_si256((const __m256i*) (y + j));
+        __m256i l = _mm256_loadu_si256((const __m256i*) (y + j + m - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(f, first),
+                                                              _mm256_cmpeq_epi8(l, last)));
+        while (mask) {
+            size_t k = j + __builtin_ctz(mask);
+            if (memcmp(y + k + 1, x + 1, m - 2) == 0) {
+                return k;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return simd_find_tail(s, y, n, j);
+}
+
+#endif
+
+// The fastest SIMD filter this CPU has, or nullptr if there is none; then
+// short needles use Horspool or Two-Way too.
+static size_t (*simd_find)(const strsearch61* s, const unsigned char* y, size_t n) =
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_supports("avx2") ? simd_find_avx2
+    : __builtin_cpu_supports("sse2") ? simd_find_sse2 :
+#endif
+    nullptr;
+
+
+/// strsearch61_prepare(s, needle, m)
+///    Prepare to search for the `m` bytes at `needle`.
+
+void strsearch61_prepare(strsearch61* s, const char* needle, size_t m) {
+    s->needle = (const unsigned char*) needle;
+    s->m = m;
+    if (m == 0) {
+        s->method = STRSEARCH61_EMPTY;
+        return;
+    } else if (m == 1) {
+        s->method = STRSEARCH61_MEMCHR;
+        return;
+    }
+
+    // Two-Way is always prepared, since Horspool may fall back on it
+    twoway_prepare(s);
+    if (m <= SIMD_MAX && simd_find) {
+        s->method = STRSEARCH61_SIMD;
+        return;
+    }
+
+    bool seen[256] = {};
+    int distinct = 0;
+    for (size_t i = 0; i != m; ++i) {
+        distinct += !seen[s->needle[i]];
+        seen[s->needle[i]] = true;
+    }
+    for (int c = 0; c != 256; ++c) {
+        s->shift[c] = m;
+    }
+    for (size_t i = 0; i + 1 < m; ++i) {
+        s->shift[s->needle[i]] = m - 1 - i;
+    }
+    if (m <= HORSPOOL_MAX && distinct >= HORSPOOL_DISTINCT) {
+        s->method = STRSEARCH61_HORSPOOL;
+    } else {
+        s->method = STRSEARCH61_TWOWAY;
+    }
+}
+
+
+/// strsearch61_find(s, haystack, n)
+///    Return the first occurrence of the prepared needle in `haystack[0..n)`,
+///    or nullptr.
+
+const char* strsearch61_find(const strsearch61* s, const char* haystack, size_t n) {
+    const unsigned char* y = (const unsigned char*) haystack;
+    size_t j;
+    switch (s->method) {
+    case STRSEARCH61_EMPTY:
+        return haystack;
+    case STRSEARCH61_MEMCHR:
+        return (const char*) memchr(y, s->needle[0], n);
+    case STRSEARCH61_SIMD:
+        j = simd_find(s, y, n);
+        break;
+    case STRSEARCH61_HORSPOOL:
+        j = horspool_find(s, y, n);
+        break;
+    default:
+        j = twoway_find(s, y, n);
+        break;
+    }
+    return j < n ? haystack + j : nullptr;
+}
+
+
+/// strstr61(s1, s2)
+///    Return the first occurrence of string `s2` in `s1`, or nullptr.
+
+char* strstr61(const char* s1, const char* s2) {
+    strsearch61 s;
+    strsearch61_prepare(&s, s2, strlen(s2));
+    return (char*) strsearch61_find(&s, s1, strlen(s1));
+}
@@ -0,0 +1,56 @@
+#ifndef STRSEARCH61_HH
+#define STRSEARCH61_HH
+#include <cstddef>
+
+// strsearch61: substring search in linear time.
+//
+// A needle is prepared once and can then be searched for in any number of
+// haystacks. Preparing picks the algorithm from the needle:
+//
+//   - up to 16 bytes, on x86: a SIMD filter that compares the needle's
+//     first and last bytes at 16 or 32 positions at once, then checks
+//     candidates;
+//   - up to 256 bytes with at least 8 distinct bytes: Horspool, which skips
+//     ahead by up to the needle length on bytes the needle lacks;
+//   - otherwise: Two-Way (Crochemore-Perrin), which takes O(n) time and
+//     O(1) space on any input, and also skips ahead like Horspool where
+//     the last byte of a window does not match.
+//
+// Horspool falls back to Two-Way if it ever does more than a few byte
+// comparisons per haystack byte, so no needle and haystack take more than
+// linear time. That includes inputs like "aaaa...ab", where a naive scan
+// takes O(n·m).
+
+enum strsearch61_method {
+    STRSEARCH61_EMPTY,
+    STRSEARCH61_MEMCHR,
+    STRSEARCH61_SIMD,
+    STRSEARCH61_HORSPOOL,
+    STRSEARCH61_TWOWAY
+};
+
+struct strsearch61 {
+    const unsigned char* needle;    // not copied: must outlive the search
+    size_t m;
+    strsearch61_method method;
+    size_t crit;                    // Two-Way: start of the right half
+    size_t period;                  // Two-Way: shift after a right-half match
+    bool periodic;                  // Two-Way: `period` is the exact period
+    size_t shift[256];              // shift by last window byte, if it
+                                    // is not the needle's last byte
+};
+
+/// strsearch61_prepare(s, needle, m)
+///    Prepare to search for the `m` bytes at `needle`. Takes O(m) time.
+void strsearch61_prepare(strsearch61* s, const char* needle, size_t m);
+
+/// strsearch61_find(s, haystack, n)
+///    Return a pointer to the first occurrence of the prepared needle in
+///    the `n` bytes at `haystack`, or nullptr if there is none.
+const char* strsearch61_find(const strsearch61* s, const char* haystack, size_t n);
+
+/// strstr61(s1, s2)
+///    Like strstr: return the first occurrence of string `s2` in `s1`.
+char* strstr61(const char* s1, const char* s2);
+
+#endif
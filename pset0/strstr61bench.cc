@@ -0,0 +1,184 @@
+//strstr61bench: time substring search on hard and easy inputs
+#include "strsearch61.hh"
+#include "multisearch61.hh"
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// strstr61bench [-n HAYSTACK_BYTES]
+//    Search for needles in haystacks built to be hard for a naive scan,
+//    such as "aaaa...ab" in "aaaa...a", and in ordinary text, with:
+//
+//      naive      the pointer scan from 2strstr61.cc
+//      strstr     the C library's strstr
+//      strstr61   strsearch61, preparing the needle on every call
+//      prepared   strsearch61_find with the needle prepared once
+//
+//    and print the throughput in MB of haystack per second. The naive scan
+//    is skipped where it would take more than about 10^10 steps.
+//
+//    Then find every occurrence of 1 to 1000 patterns in text, by calling
+//    strstr repeatedly for each pattern, and with one multisearch61 scan.
+
+static char* naive_strstr(const char* s1, const char* s2) {
+    while (*s1) {
+        const char* s1try = s1;
+        const char* s2try = s2;
+        while (*s2try && *s2try == *s1try) {
+            ++s2try;
+            ++s1try;
+        }
+        if (!*s2try) {
+            return (char*) s1;
+        }
+        ++s1;
+    }
+    if (!*s2) {
+        return (char*) s1;
+    }
+    return nullptr;
+}
+
+static double now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// measure(name, n, f)
+//    Run `f` until at least 0.2 seconds have passed and print the rate for
+//    an `n`-byte haystack.
+template <typename F>
+static void measure(const char* name, size_t n, F f) {
+    const char* result = nullptr;
+    int runs = 0;
+    double start = now(), elapsed;
+    do {
+        result = f();
+        ++runs;
+        elapsed = now() - start;
+    } while (elapsed < 0.2);
+    printf("  %-10s %10.1f MB/s   %s\n", name, n * runs / elapsed / 1e6,
+           result ? "found" : "not found");
+}
+
+static void bench(const char* name, const std::string& hay, const std::string& needle) {
+    printf("%s (haystack %zu bytes, needle %zu bytes)\n", name, hay.size(), needle.size());
+    const char* h = hay.c_str();
+    const char* x = needle.c_str();
+    if ((double) hay.size() * needle.size() <= 1e10) {
+        measure("naive", hay.size(), [&] { return naive_strstr(h, x); });
+    }
+    measure("strstr", hay.size(), [&] { return strstr(h, x); });
+    measure("strstr61", hay.size(), [&] { return strstr61(h, x); });
+    strsearch61 s;
+    strsearch61_prepare(&s, x, needle.size());
+    measure("prepared", hay.size(), [&] { return strsearch61_find(&s, h, hay.size()); });
+}
+
+static void count_match(size_t, size_t, void* arg) {
+    ++*(size_t*) arg;
+}
+
+static void bench_multi(const std::string& text, const std::vector<std::string>& patterns) {
+    printf("text, %zu patterns\n", patterns.size());
+    const char* h = text.c_str();
+    size_t nfound = 0;
+    measure("strstr", text.size(), [&] {
+        nfound = 0;
+        for (auto& pat : patterns) {
+            for (const char* s = strstr(h, pat.c_str()); s; s = strstr(s + 1, pat.c_str())) {
+                ++nfound;
+            }
+        }
+        return h;
+    });
+    printf("  %zu matches\n", nfound);
+
+    multisearch61 ms;
+    std::vector<const char*> ptrs;
+    std::vector<size_t> lengths;
+    for (auto& pat : patterns) {
+        ptrs.push_back(pat.data());
+        lengths.push_back(pat.size());
+    }
+    multisearch61_compile(&ms, ptrs.data(), lengths.data(), patterns.size());
+    measure("multi", text.size(), [&] {
+        multisearch61_stream stream;
+        nfound = 0;
+        multisearch61_scan(&ms, &stream, h, text.size(), count_match, &nfound);
+        return h;
+    });
+    printf("  %zu matches, %zu states x %zu byte classes\n",
+           nfound, ms.transitions.size() / ms.nclasses, ms.nclasses);
+}
+
+int main(int argc, char** argv) {
+    size_t n = 1 << 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            n = strtoul(optarg, nullptr, 0);
+        } else {
+            fprintf(stderr, "Usage: strstr61bench [-n HAYSTACK_BYTES]\n");
+            exit(1);
+        }
+    }
+
+    // adversarial: every position almost matches
+    std::string as(n, 'a');
+    bench("a^n, a^7 b", as, std::string(7, 'a') + "b");
+    bench("a^n, a^99 b", as, std::string(99, 'a') + "b");
+    bench("a^n, a^999 b", as, std::string(999, 'a') + "b");
+    bench("a^n b, a^999 b", as + "b", std::string(999, 'a') + "b");
+    bench("a^n, bcdefghij a^100", as, "bcdefghij" + std::string(100, 'a'));
+    std::string abs;
+    while (abs.size() < n) {
+        abs += "ab";
+    }
+    bench("(ab)^n, (ab)^50 b", abs, [] {
+        std::string x;
+        for (int i = 0; i != 50; ++i) {
+            x += "ab";
+        }
+        return x + "b";
+    }());
+
+    // ordinary text: random words
+    static const char* words[] = {
+        "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+        "memory", "allocator", "process", "kernel", "page", "table", "cache",
+        "buffer", "thread", "lock", "signal", "pipe"
+    };
+    std::string text;
+    srandom(61);
+    while (text.size() < n) {
+        text += words[random() % 20];
+        text += random() % 10 ? ' ' : '\n';
+    }
+    bench("text, short word", text, "zebra");
+    bench("text, phrase", text, "the lazy allocator jumps over the kernel cache");
+    bench("text, long phrase", text, std::string(300, 'x') + " kernel");
+
+    // many patterns: word pairs from the text, and made-up words
+    std::vector<std::string> patterns;
+    for (size_t npatterns = 1; npatterns <= 1000; npatterns *= 10) {
+        while (patterns.size() < npatterns) {
+            std::string pat = words[random() % 20];
+            if (random() % 4 == 0) {
+                pat += " ";
+                pat += words[random() % 20];
+            } else if (random() % 2 == 0) {
+                pat += std::to_string(random() % 1000);
+            }
+            patterns.push_back(pat);
+        }
+        bench_multi(text, patterns);
+    }
+}
+
+//$ c++ -std=gnu++1z -Wall -g -O3 strstr61bench.cc strsearch61.cc multisearch61.cc -o strstr61bench
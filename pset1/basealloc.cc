@@ -1,7 +1,6 @@
 #define M61_DISABLE 1
 #include "m61.hh"
-#include <unordered_map>
-#include <vector>
+#include <cstdint>
 #include <sys/mman.h>
 
 
@@ -9,28 +8,56 @@
 // overwrite freed allocations. No need to understand it.
 
 
-using base_allocation = std::pair<uintptr_t, size_t>;
+// Every block starts with a `base_header`. Requests are rounded up to one
+// of NCLASSES size classes, and each class keeps its freed blocks on a FIFO
+// quarantine queue. A freed block is only handed out again once at least
+// QUARANTINE later frees of its class are queued behind it, so freed memory
+// is never reused right away. Allocation and free are O(1).
+//
+// The free list links live in the header, so the contents of a freed
+// block stay exactly as they were until it is reused.
 
-// `allocs` is a hash table mapping active pointer address to allocation size.
-// `frees` is a vector of freed allocations.
-static std::unordered_map<uintptr_t, size_t> allocs;
-static std::vector<base_allocation> frees;
-static int disabled;
+struct base_header {
+    uintptr_t link;             // active: address XOR BASE_MAGIC;
+                                // freed: next block in the queue
+    size_t size;                // capacity of the block
+};
 
-static unsigned alloc_random() {
-    static uint64_t x = 8973443640547502487ULL;
-    x = x * 6364136223846793005ULL + 1ULL;
-    return x >> 32;
-}
+struct base_queue {
+    base_header* head;          // oldest freed block
+    base_header* tail;          // newest freed block
+    size_t n;
+};
+
+static const uintptr_t BASE_MAGIC = 0xBA5EA110C8ED0000ULL;
+static const size_t QUARANTINE = 64;
+static const int NCLASSES = 237;
+static base_queue queues[NCLASSES];
+static int disabled;
 
 static void base_allocator_atexit();
 
+// size_class(sz, capacity)
+//    Return the size class of a `sz`-byte request and set `*capacity` to
+//    the size of blocks in that class: multiples of 16 up to 128, then four
+//    steps per power of two. Returns -1 if `sz` is absurdly large.
+static int size_class(size_t sz, size_t* capacity) {
+    if (sz <= 128) {
+        *capacity = (sz + 15) & ~size_t(15);
+        return *capacity / 16;
+    } else if (sz > (SIZE_MAX >> 2)) {
+        return -1;
+    }
+    int shift = 63 - __builtin_clzl(sz - 1);            // sz in (2^shift, 2^(shift+1)]
+    size_t step = size_t(1) << (shift - 2);
+    *capacity = (sz + step - 1) & ~(step - 1);
+    return 9 + (shift - 7) * 4 + (*capacity >> (shift - 2)) - 5;
+}
+
 void* base_malloc(size_t sz) {
     if (disabled) {
         return malloc(sz);
     }
-    ++disabled;
-    uintptr_t ptr = 0;
 
     static int base_alloc_atexit_installed = 0;
     if (!base_alloc_atexit_installed) {
@@ -38,49 +65,56 @@ void* base_malloc(size_t sz) {
         base_alloc_atexit_installed = 1;
     }
 
-    // try to use a previously-freed block 75% of the time
-    unsigned r = alloc_random();
-    if (r % 4 != 0) {
-        for (unsigned ntries = 0; ntries < 10 && ntries < frees.size(); ++ntries) {
-            auto& f = frees[alloc_random() % frees.size()];
-            if (f.second >= sz) {
-                allocs.insert(f);
-                ptr = f.first;
-                f = frees.back();
-                frees.pop_back();
-                break;
-            }
-        }
+    size_t capacity;
+    int c = size_class(sz, &capacity);
+    if (c < 0) {
+        return nullptr;
     }
 
-    if (!ptr) {
-        // need a new allocation
-        ptr = reinterpret_cast<uintptr_t>(malloc(sz ? sz : 1));
-    }
-    if (ptr) {
-        allocs[reinterpret_cast<uintptr_t>(ptr)] = sz;
+    // reuse the oldest freed block of the class if it has waited long enough
+    base_header* h;
+    base_queue& q = queues[c];
+    if (q.n > QUARANTINE) {
+        h = q.head;
+        q.head = reinterpret_cast<base_header*>(h->link);
+        --q.n;
+    } else {
+        h = reinterpret_cast<base_header*>(malloc(sizeof(base_header) + capacity));
+        if (!h) {
+            return nullptr;
+        }
+        h->size = capacity;
     }
-
-    --disabled;
+    uintptr_t ptr = reinterpret_cast<uintptr_t>(h + 1);
+    h->link = ptr ^ BASE_MAGIC;
     return reinterpret_cast<void*>(ptr);
 }
 
 void base_free(void* ptr) {
-    if (disabled || !ptr) {
-        free(ptr);
-    } else {
-        // mark free if found; if not found, complain about invalid free
-        ++disabled;
-        auto it = allocs.find(reinterpret_cast<uintptr_t>(ptr));
-        if (it != allocs.end()) {
-            frees.push_back(*it);
-            allocs.erase(it);
+    if (!ptr) {
+        return;
+    }
+    base_header* h = reinterpret_cast<base_header*>(ptr) - 1;
+    if (h->link != (reinterpret_cast<uintptr_t>(ptr) ^ BASE_MAGIC)) {
+        if (disabled) {
+            free(ptr);              // allocated while disabled
         } else {
             fprintf(stderr, "ERROR: invalid free of %p at %p", ptr,
                     __builtin_extract_return_addr(__builtin_return_address(0)));
         }
-        --disabled;
+        return;
     }
+
+    size_t capacity;
+    base_queue& q = queues[size_class(h->size, &capacity)];
+    h->link = 0;
+    if (q.n) {
+        q.tail->link = reinterpret_cast<uintptr_t>(h);
+    } else {
+        q.head = h;
+    }
+    q.tail = h;
+    ++q.n;
 }
 
 void base_allocator_disable(bool d) {
@@ -89,7 +123,11 @@ void base_allocator_disable(bool d) {
 
 static void base_allocator_atexit() {
     // clean up freed memory to shut up leak detector
-    for (auto& alloc : frees) {
-        free(reinterpret_cast<void*>(alloc.first));
+    for (auto& q : queues) {
+        for (base_header* h = q.head; q.n; --q.n) {
+            base_header* next = reinterpret_cast<base_header*>(h->link);
+            free(h);
+            h = next;
+        }
     }
 }
@@ -1,253 +1,1751 @@
 #define M61_DISABLE 1
 #include "m61.hh"
+#include "m61stats.hh"
+#include "m61preload.hh"
+#include "m61trace.hh"
+#include "m61site.hh"
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
 #include <cinttypes>
 #include <cassert>
+#include <cmath>
 #include <iostream>
 
-#include <set>
 #include <unordered_map>
 #include <cstddef>
 #include <vector>
 #include <algorithm>
+#include <map>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <ctime>
+#include <string>
 
-// An internal record of all statistics so far.
-m61_statistics mystats = {0, 0, 0, 0, 0, 0, 0, 0};
+// The largest integer. Used as a special value to indicate a freed pointer.
+size_t LARGEST_INT = (size_t)-1;
+
+// Runtime options, read from the environment the first time m61 is used.
+struct options {
+  bool slab;      // M61_SLAB=1: serve small blocks from the slab backend
+  bool threads;   // M61_THREADS=1: m61 may be called from several threads
+  size_t hh_k;    // M61_HH_K=k: track heavy hitters in k counters, not exactly
+  size_t sample_interval;  // M61_SAMPLE=n: only track about one pointer per
+                           // n bytes allocated
+  bool trace;     // M61_TRACE=FILE: log every operation to FILE, see m61trace.hh
+  size_t guard;   // M61_GUARD=n: put blocks of n or more bytes right before
+                  // an inaccessible guard page
+  bool poison;    // M61_POISON=1: overwrite freed data with POISON_BYTE
+  size_t quarantine;  // M61_QUARANTINE=n: hold up to n bytes of poisoned
+                      // freed blocks and check them for writes after free
+};
+struct options opts = {false, false, 0, 0, false, 0, false, 0};
+bool m61_default_threads = false;
+
+// A lock guard that only locks when M61_THREADS is on, so single-threaded
+// programs don't pay for locking.
+struct mt_guard {
+  std::mutex* lk;
+  mt_guard(std::mutex& m) : lk(opts.threads ? &m : nullptr) {
+    if (lk) {
+      lk->lock();
+    }
+  }
+  ~mt_guard() {
+    unlock();
+  }
+  void unlock() {
+    if (lk) {
+      lk->unlock();
+      lk = nullptr;
+    }
+  }
+};
+
+// A map that maps file names to another dictionary whose keys are lines and values are total sizes of allocation.
+using hhmap_type = std::unordered_map <const char*, std::unordered_map <long, size_t>>;
+
+// A counter of a streaming heavy hitter summary. The true number of bytes
+// allocated at `file`:`line` is between `count - error` and `count`.
+struct hh_counter {
+  const char* file;
+  long line;
+  size_t count;
+  size_t error;
+  size_t hslot;     // position of this counter in `hh_summary::index`
+};
+
+// A Space-Saving summary (Metwally et al.) of allocation sites, used instead
+// of `hhmap` when M61_HH_K is set. It keeps at most `k` counters in a min-heap
+// ordered by count; a new site takes over the smallest counter and inherits
+// its count as error. Every site with more than 1/k of all bytes is sure to
+// have a counter. Memory stays fixed at O(k) however many sites there are.
+struct hh_summary {
+  size_t k;               // number of counters
+  size_t n;               // number of counters in use
+  struct hh_counter* heap;  // min-heap of counters
+  size_t* index;          // hash table from site to heap position (or -1)
+  size_t mask;            // size of `index` minus 1
+};
+
+// An internal record of the statistics of one thread. Each thread only
+// writes its own shard, so the counters need no atomic read-modify-write;
+// m61_get_statistics adds all shards up.
+struct stats_shard {
+  std::atomic<unsigned long long> ntotal;       // number of allocations
+  std::atomic<unsigned long long> total_size;   // total size of allocations
+  std::atomic<unsigned long long> nfree;        // number of freed pointers
+  std::atomic<unsigned long long> free_size;    // total size of freed pointers
+  std::atomic<unsigned long long> nfail;        // number of failed allocations
+  std::atomic<unsigned long long> fail_size;    // total size of failed allocations
+  std::atomic<unsigned long long> size_histogram[M61_NSIZE_BUCKETS];
+                                                // allocations by size_bucket()
+  std::mutex hhlock;                            // protects `hhmap`, `hhsummary`
+  hhmap_type hhmap;                             // heavy hitters of this thread
+  struct hh_summary hhsummary;                  // ... if M61_HH_K is set
+  size_t bytes_until_sample;                    // bytes left before next sample
+  uint64_t sample_random;                       // random state for sampling
+  struct stats_shard* next;                     // next shard in `all_shards`
+};
+
+// All statistics shards, newest first. Shards are never freed, so counts of
+// threads that have exited still show up.
+std::atomic<struct stats_shard*> all_shards(nullptr);
+
+// The calling thread's statistics shard.
+thread_local struct stats_shard* my_shard = nullptr;
+
+// The smallest and largest addresses ever allocated.
+std::atomic<uintptr_t> heap_min(0);
+std::atomic<uintptr_t> heap_max(0);
+
+
+// hh_hash(file, line)
+//    Hash an allocation site.
+
+static inline size_t hh_hash(const char* file, long line) {
+    return ((uintptr_t) file * 0x9E3779B97F4A7C15UL) ^ ((size_t) line * 0xC2B2AE3D27D4EB4FUL);
+}
+
+// hh_summary_init(hs, k)
+//    Set up `hs` with `k` counters. This is the only allocation it makes.
+
+static void hh_summary_init(struct hh_summary* hs, size_t k) {
+    hs->k = k;
+    hs->n = 0;
+    hs->heap = new hh_counter[k];
+    hs->mask = 1;
+    while (hs->mask < 2 * k) {
+      hs->mask <<= 1;
+    }
+    hs->index = new size_t[hs->mask];
+    for (size_t i = 0; i < hs->mask; i++) {
+      hs->index[i] = LARGEST_INT;
+    }
+    hs->mask -= 1;
+}
+
+// hh_summary_find(hs, file, line)
+//    Return the heap position of the counter for `file`:`line`, or
+//    LARGEST_INT if the site has no counter.
+
+static size_t hh_summary_find(const struct hh_summary* hs, const char* file, long line) {
+    if (hs->n == 0) {
+      return LARGEST_INT;
+    }
+    for (size_t h = hh_hash(file, line) & hs->mask; hs->index[h] != LARGEST_INT; h = (h + 1) & hs->mask) {
+      const struct hh_counter* c = &hs->heap[hs->index[h]];
+      if (c->file == file && c->line == line) {
+        return hs->index[h];
+      }
+    }
+    return LARGEST_INT;
+}
+
+// hh_summary_swap(hs, i, j)
+//    Swap heap positions `i` and `j`, keeping the index up to date.
+
+static void hh_summary_swap(struct hh_summary* hs, size_t i, size_t j) {
+    std::swap(hs->heap[i], hs->heap[j]);
+    hs->index[hs->heap[i].hslot] = i;
+    hs->index[hs->heap[j].hslot] = j;
+}
+
+// hh_summary_sift_up(hs, i)
+//    Restore the heap order above position `i` after a counter was added.
+
+static void hh_summary_sift_up(struct hh_summary* hs, size_t i) {
+    while (i > 0 && hs->heap[(i - 1) / 2].count > hs->heap[i].count) {
+      hh_summary_swap(hs, i, (i - 1) / 2);
+      i = (i - 1) / 2;
+    }
+}
+
+// hh_summary_sift_down(hs, i)
+//    Restore the heap order below position `i` after its count grew.
+
+static void hh_summary_sift_down(struct hh_summary* hs, size_t i) {
+    while (true) {
+      size_t smallest = i;
+      size_t l = 2 * i + 1, r = 2 * i + 2;
+      if (l < hs->n && hs->heap[l].count < hs->heap[smallest].count) {
+        smallest = l;
+      }
+      if (r < hs->n && hs->heap[r].count < hs->heap[smallest].count) {
+        smallest = r;
+      }
+      if (smallest == i) {
+        return;
+      }
+      hh_summary_swap(hs, i, smallest);
+      i = smallest;
+    }
+}
+
+// hh_summary_unindex(hs, hslot)
+//    Remove entry `hslot` from the index, shifting later entries of its
+//    probe run back so lookups never see a hole.
+
+static void hh_summary_unindex(struct hh_summary* hs, size_t hslot) {
+    size_t hole = hslot;
+    for (size_t j = (hole + 1) & hs->mask; hs->index[j] != LARGEST_INT; j = (j + 1) & hs->mask) {
+      struct hh_counter* c = &hs->heap[hs->index[j]];
+      size_t home = hh_hash(c->file, c->line) & hs->mask;
+      // move entry `j` into the hole unless its home lies in (hole, j]
+      if (((j - home) & hs->mask) >= ((j - hole) & hs->mask)) {
+        hs->index[hole] = hs->index[j];
+        c->hslot = hole;
+        hole = j;
+      }
+    }
+    hs->index[hole] = LARGEST_INT;
+}
+
+// hh_summary_add(hs, file, line, sz)
+//    Count `sz` bytes allocated at `file`:`line`. O(log k).
+
+static void hh_summary_add(struct hh_summary* hs, const char* file, long line, size_t sz) {
+    size_t pos = hh_summary_find(hs, file, line);
+    if (pos == LARGEST_INT) {
+      size_t error = 0;
+      if (hs->n < hs->k) {
+        // use a free counter at the bottom of the heap
+        pos = hs->n++;
+        hs->heap[pos].count = 0;
+      } else {
+        // take over the counter of the smallest site
+        pos = 0;
+        hh_summary_unindex(hs, hs->heap[0].hslot);
+        error = hs->heap[0].count;
+      }
+      size_t h = hh_hash(file, line) & hs->mask;
+      while (hs->index[h] != LARGEST_INT) {
+        h = (h + 1) & hs->mask;
+      }
+      hs->index[h] = pos;
+      hs->heap[pos].file = file;
+      hs->heap[pos].line = line;
+      hs->heap[pos].error = error;
+      hs->heap[pos].hslot = h;
+    }
+    hs->heap[pos].count += sz;
+    hh_summary_sift_down(hs, pos);
+    hh_summary_sift_up(hs, pos);
+}
+
+
+// get_shard()
+//    Return the calling thread's statistics shard, creating it on first use.
+
+static struct stats_shard* get_shard() {
+    if (!my_shard) {
+      my_shard = new stats_shard();
+      struct stats_shard* head = all_shards.load();
+      do {
+        my_shard->next = head;
+      } while (!all_shards.compare_exchange_weak(head, my_shard));
+    }
+    return my_shard;
+}
+
+// add(counter, n)
+//    Add `n` to a counter owned by the calling thread's shard.
+
+static inline void add(std::atomic<unsigned long long>& counter, unsigned long long n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+
+// Allocation sites. Every file:line gets a small id, which indexes `sites`
+// and the site table of the trace. Ids are handed out through `site_slots`,
+// an open-addressing table keyed by file pointer and line that is twice the
+// size of `sites`. Lookups take no lock; adding a site takes `site_lock`.
+
+const uint32_t NSITES = M61_TRACE_NSITES;
+const uint32_t NOSITE = M61_TRACE_NOSITE;     // `sites` was full
+const uint32_t UNKNOWN_SITE = NOSITE - 1;     // not looked up yet
+const int SITE_SLOT_BITS = 17;
+static_assert((1 << SITE_SLOT_BITS) == 2 * NSITES, "site slots");
+
+struct site_slot {
+  std::atomic<const char*> file;   // set last, once `line` and `id` are
+  long line;
+  uint32_t id;
+};
+
+// An allocation site and its active pointers.
+struct site {
+  const char* file;
+  long line;
+  std::atomic<unsigned long long> active_size;  // bytes allocated here, not freed
+  std::atomic<unsigned long long> nactive;      // pointers allocated here, not freed
+  std::atomic<unsigned long long> total_size;   // bytes ever allocated here, for
+                                                // the exact heavy hitter report
+};
+
+struct site_slot* site_slots;
+struct site* sites;
+std::atomic<uint32_t> nsites(0);
+std::mutex site_lock;
+
+// The number of active bytes, and the most there ever were, when, in ns
+// since m61 started at `start_time`.
+std::atomic<unsigned long long> active_size(0);
+std::atomic<unsigned long long> peak_active_size(0);
+std::atomic<unsigned long long> peak_time(0);
+unsigned long long start_time;
+
+// The trace (M61_TRACE) is a file mapped into memory with MAP_SHARED; see
+// m61trace.hh for its layout. Appending a record takes no system calls:
+// the slot comes from an atomic counter, and the kernel writes the pages
+// back, even if the program crashes. Records name their site by its id.
+
+struct m61_trace_header* trace_header;
+struct m61_trace_site* trace_sites;
+struct m61_trace_record* trace_records;
+
+
+// now()
+//    Return the CLOCK_MONOTONIC time in ns. Runs in the vDSO, so it makes
+//    no system call.
+
+static inline unsigned long long now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// sites_open()
+//    Reserve the site tables. Returns false on failure.
+
+static bool sites_open() {
+    void* slots = mmap(nullptr, sizeof(struct site_slot) << SITE_SLOT_BITS, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    void* s = mmap(nullptr, sizeof(struct site) * NSITES, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (slots == MAP_FAILED || s == MAP_FAILED) {
+      return false;
+    }
+    site_slots = (struct site_slot*) slots;
+    sites = (struct site*) s;
+    return true;
+}
+
+// trace_open(filename, nrecords)
+//    Create the trace file `filename` with room for `nrecords` records and
+//    map it. Returns false on failure.
+
+static bool trace_open(const char* filename, size_t nrecords) {
+    size_t filesz = M61_TRACE_HEADER_SIZE + M61_TRACE_NSITES * sizeof(struct m61_trace_site)
+      + nrecords * sizeof(struct m61_trace_record);
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+      return false;
+    }
+    void* m = MAP_FAILED;
+    if (ftruncate(fd, filesz) == 0) {
+      m = mmap(nullptr, filesz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (m == MAP_FAILED) {
+      return false;
+    }
+
+    trace_header = (struct m61_trace_header*) m;
+    trace_header->capacity = nrecords;
+    trace_header->start_time = start_time;
+    trace_header->magic = M61_TRACE_MAGIC;
+    trace_sites = (struct m61_trace_site*) ((char*) m + M61_TRACE_HEADER_SIZE);
+    trace_records = (struct m61_trace_record*) (trace_sites + M61_TRACE_NSITES);
+    return true;
+}
+
+// Sites recorded by the LD_PRELOAD interposer (m61preload.cc) have this
+// `file` and the return address of the allocation call as `line`.
+const char m61_return_address[] = "?";
+
+// The names of return address sites, looked up the first time a report
+// prints them.
+std::unordered_map<long, std::string> return_address_names;
+std::mutex return_address_lock;
+
+// site_name(file, line, sep)
+//    Return `file`, `sep`, `line` for printing. Return address sites are
+//    named `object(symbol+0xoffset)` like backtrace_symbols does, using
+//    dladdr. The lookup happens here, when a report is printed, so
+//    allocations through the interposer don't pay for it.
+
+static std::string site_name(const char* file, long line, char sep = ':') {
+    if (file != m61_return_address) {
+      return std::string(file ? file : "?") + sep + std::to_string(line);
+    }
+    mt_guard guard(return_address_lock);
+    auto it = return_address_names.find(line);
+    if (it != return_address_names.end()) {
+      return it->second;
+    }
+    Dl_info info;
+    char buf[BUFSIZ];
+    if (dladdr((void*) line, &info) && info.dli_fname) {
+      const char* object = strrchr(info.dli_fname, '/');
+      object = object ? object + 1 : info.dli_fname;
+      if (info.dli_sname) {
+        snprintf(buf, sizeof(buf), "%s(%s+0x%lx)", object, info.dli_sname,
+                 (unsigned long) (line - (uintptr_t) info.dli_saddr));
+      } else {
+        snprintf(buf, sizeof(buf), "%s(+0x%lx)", object,
+                 (unsigned long) (line - (uintptr_t) info.dli_fbase));
+      }
+    } else {
+      snprintf(buf, sizeof(buf), "?(0x%lx)", (unsigned long) line);
+    }
+    return return_address_names[line] = buf;
+}
+
+// site_id(file, line)
+//    Return the id of `file`:`line`, adding it if needed. Returns NOSITE if
+//    there is no room.
+
+static uint32_t site_id(const char* file, long line) {
+    if (!site_slots) {
+      return NOSITE;
+    }
+    size_t mask = ((size_t) 1 << SITE_SLOT_BITS) - 1;
+    size_t start = (((uintptr_t) file + line) * 0x9E3779B97F4A7C15UL) >> (64 - SITE_SLOT_BITS);
+    for (size_t i = start; ; i = (i + 1) & mask) {
+      const char* f = site_slots[i].file.load(std::memory_order_acquire);
+      if (f == nullptr) {
+        break;
+      } else if (f == file && site_slots[i].line == line) {
+        return site_slots[i].id;
+      }
+    }
+
+    mt_guard guard(site_lock);
+    for (size_t i = start; ; i = (i + 1) & mask) {
+      const char* f = site_slots[i].file.load(std::memory_order_relaxed);
+      if (f == file && site_slots[i].line == line) {
+        return site_slots[i].id;        // another thread added it
+      } else if (f == nullptr) {
+        uint32_t id = nsites.load(std::memory_order_relaxed);
+        if (id == NSITES) {
+          return NOSITE;
+        }
+        sites[id].file = file;
+        sites[id].line = line;
+        if (opts.trace) {
+          Dl_info info;
+          const char* name = file ? file : "?";
+          trace_sites[id].line = line;
+          if (file == m61_return_address && dladdr((void*) line, &info) && info.dli_fname) {
+            // m61trace runs in another process, so name the site now, by
+            // its object and offset, which addr2line understands
+            name = strrchr(info.dli_fname, '/') ? strrchr(info.dli_fname, '/') + 1 : info.dli_fname;
+            trace_sites[id].line = line - (uintptr_t) info.dli_fbase;
+          }
+          strncpy(trace_sites[id].file, name, M61_TRACE_FILESZ - 1);
+          trace_header->nsites.store(id + 1, std::memory_order_release);
+        }
+        nsites.store(id + 1, std::memory_order_release);
+        site_slots[i].line = line;
+        site_slots[i].id = id;
+        site_slots[i].file.store(file, std::memory_order_release);
+        return id;
+      }
+    }
+}
+
+// trace_record(op, ptr, sz, file, line)
+//    Append a record of operation `op` on `ptr` with size `sz` at
+//    `file`:`line` to the trace.
+
+static void trace_record(uint32_t op, uintptr_t ptr, size_t sz, const char* file, long line) {
+    unsigned long long time = now();
+    uint64_t i = trace_header->nrecords.fetch_add(1, std::memory_order_relaxed);
+    struct m61_trace_record* r = &trace_records[i % trace_header->capacity];
+    r->op = op;
+    r->site = site_id(file, line);
+    r->ptr = ptr;
+    r->size = sz;
+    r->time = time - start_time;
+}
+
+// add_shared(counter, n)
+//    Add `n` to a counter that any thread may change, and return the new
+//    value.
+
+static inline unsigned long long add_shared(std::atomic<unsigned long long>& counter,
+                                            unsigned long long n) {
+    if (opts.threads) {
+      return counter.fetch_add(n, std::memory_order_relaxed) + n;
+    }
+    add(counter, n);
+    return counter.load(std::memory_order_relaxed);
+}
+
+// size_bucket(sz)
+//    Return the size histogram bucket of `sz`: 0 for 0 bytes, otherwise
+//    bucket `i` holds sizes in [2^(i-1), 2^i).
+
+static inline int size_bucket(size_t sz) {
+    return sz ? 64 - __builtin_clzl(sz) : 0;
+}
+
+// record_malloc(shard, sz)
+//    Count an allocation of `sz` bytes, and a new peak if there is one.
+
+static void record_malloc(struct stats_shard* shard, size_t sz) {
+    add(shard->ntotal, 1);
+    add(shard->total_size, sz);
+    add(shard->size_histogram[size_bucket(sz)], 1);
+
+    unsigned long long active = add_shared(active_size, sz);
+    unsigned long long peak = peak_active_size.load(std::memory_order_relaxed);
+    while (active > peak) {
+      if (peak_active_size.compare_exchange_weak(peak, active, std::memory_order_relaxed)) {
+        peak_time.store(now() - start_time, std::memory_order_relaxed);
+        break;
+      }
+    }
+}
+
+// record_free(shard, sz)
+//    Count a free of `sz` bytes.
+
+static void record_free(struct stats_shard* shard, size_t sz) {
+    add(shard->nfree, 1);
+    add(shard->free_size, sz);
+    add_shared(active_size, -(unsigned long long) sz);
+}
+
+// record_site(id, sz, n)
+//    Count `n` more (or, if negative, fewer) active pointers of `sz` bytes
+//    each allocated at site `id`.
+
+static void record_site(uint32_t id, size_t sz, int n) {
+    if (id != NOSITE) {
+      add_shared(sites[id].active_size, n * (unsigned long long) sz);
+      add_shared(sites[id].nactive, n);
+    }
+}
+
+// record_fail(sz, file, line)
+//    Count a failed allocation of `sz` bytes at `file`:`line`.
+
+static void record_fail(size_t sz, const char* file, long line) {
+    struct stats_shard* shard = get_shard();
+    add(shard->nfail, 1);
+    add(shard->fail_size, sz);
+    if (opts.trace) {
+      trace_record(M61_TRACE_FAIL, 0, sz, file, line);
+    }
+}
+
+// extend_heap(ptr, endptr)
+//    Widen [heap_min, heap_max] to include [ptr, endptr].
+
+static void extend_heap(uintptr_t ptr, uintptr_t endptr) {
+    uintptr_t lo = heap_min.load(std::memory_order_relaxed);
+    while ((lo == 0 || ptr < lo)
+           && !heap_min.compare_exchange_weak(lo, ptr)) {
+    }
+    uintptr_t hi = heap_max.load(std::memory_order_relaxed);
+    while (endptr > hi
+           && !heap_max.compare_exchange_weak(hi, endptr)) {
+    }
+}
+
+// A structure that describes all attributes of a pointer. It is stored inline
+// in the metadata right before the pointer, so tracking a pointer never needs
+// an allocation of its own.
+struct attributes {
+  const char* file;
+  long line;
+  size_t sz;              // size of data; LARGEST_INT once freed
+  uint32_t magic;         // address of this struct XOR ACTIVE_MAGIC, low bits
+  uint32_t site;          // site id of file:line
+  struct attributes* prev;  // previous active pointer in the list
+  struct attributes* next;  // next active pointer in the list
+  struct attributes* page_prev;  // previous block starting on the same page
+  struct attributes* page_next;  // next block starting on the same page
+};
+
+// A value mixed into `attributes::magic` of active pointers. A header copied
+// somewhere else, or random data, will not match it.
+const uint32_t ACTIVE_MAGIC = 0x7EDB10CBU;
+
+// A constant used for the alignment of metadata. The metadata holds a
+// `struct attributes`, rounded up so that the data stays aligned, and then
+// the leading redzone.
+size_t METADATA_SIZE = (sizeof(struct attributes) + alignof(std::max_align_t) - 1)
+                       / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+// The redzones before and after each pointer's data. They are filled with
+// REDZONE_BYTE and checked when the pointer is freed. By default there is
+// only an 8-byte trailing redzone; M61_REDZONE=n makes both n bytes, rounded
+// up to a multiple of 16, at most MAX_REDZONE.
+size_t LEADING_REDZONE = 0;
+size_t TRAILING_REDZONE = 8;
+const size_t MAX_REDZONE = 64;
+const unsigned char REDZONE_BYTE = 0xAB;
+
+// With M61_POISON, freed data is overwritten with POISON_BYTE.
+const unsigned char POISON_BYTE = 0xDD;
+
+
+// bytes_equal_scalar(p, n, c)
+//    Return true if the `n` bytes at `p` all equal `c`. Compares 8 bytes at
+//    a time.
+
+static bool bytes_equal_scalar(const unsigned char* p, size_t n, unsigned char c) {
+    uint64_t pattern = 0x0101010101010101ULL * c;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      uint64_t w;
+      memcpy(&w, p + i, 8);
+      if (w != pattern) {
+        return false;
+      }
+    }
+    for (; i < n; i++) {
+      if (p[i] != c) {
+        return false;
+      }
+    }
+    return true;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// bytes_equal_sse2(p, n, c), bytes_equal_avx2(p, n, c)
+//    Like bytes_equal_scalar, 16 or 32 bytes at a time.
+
+__attribute__((target("sse2")))
+static bool bytes_equal_sse2(const unsigned char* p, size_t n, unsigned char c) {
+    __m128i pattern = _mm_set1_epi8((char) c);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, pattern)) != 0xFFFF) {
+        return false;
+      }
+    }
+    return bytes_equal_scalar(p + i, n - i, c);
+}
+
+__attribute__((target("avx2")))
+static bool bytes_equal_avx2(const unsigned char* p, size_t n, unsigned char c) {
+    __m256i pattern = _mm256_set1_epi8((char) c);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i*) (p + i));
+      if ((unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, pattern)) != 0xFFFFFFFFU) {
+        return false;
+      }
+    }
+    // leave AVX state before running non-VEX SSE code, or every SSE
+    // instruction after this pays a transition penalty
+    _mm256_zeroupper();
+    return bytes_equal_sse2(p + i, n - i, c);
+}
+#endif
+
+// The fastest bytes_equal kernel this CPU has; picked in load_options().
+bool (*bytes_equal)(const unsigned char* p, size_t n, unsigned char c) = bytes_equal_scalar;
+
+// Intrusive doubly linked lists of all active pointers allocated through
+// m61_malloc(). A pointer lives on the list picked by a hash of its address,
+// so threads mostly take different locks. `head` is the most recently
+// allocated pointer of a list.
+struct active_list {
+  std::mutex lock;
+  struct attributes* head;
+};
+const int NACTIVE_LISTS = 64;
+struct active_list active_lists[NACTIVE_LISTS];
+
+
+// active_list_of(info)
+//    Return the active pointer list that `info` belongs on.
+
+static inline struct active_list* active_list_of(struct attributes* info) {
+    uintptr_t h = ((uintptr_t) info >> 4) * 0x9E3779B97F4A7C15UL;
+    return &active_lists[h >> 58];
+}
+
+// active_insert(info)
+//    Link `info` at the head of its active pointer list. O(1).
+
+static void active_insert(struct attributes* info) {
+    struct active_list* list = active_list_of(info);
+    mt_guard guard(list->lock);
+    info->magic = (uint32_t) (uintptr_t) info ^ ACTIVE_MAGIC;
+    info->prev = nullptr;
+    info->next = list->head;
+    if (list->head) {
+      list->head->prev = info;
+    }
+    list->head = info;
+}
+
+// active_erase(info)
+//    Unlink `info` from its active pointer list. O(1). The caller must hold
+//    the list's lock.
+
+static void active_erase(struct attributes* info) {
+    if (info->prev) {
+      info->prev->next = info->next;
+    } else {
+      active_list_of(info)->head = info->next;
+    }
+    if (info->next) {
+      info->next->prev = info->prev;
+    }
+    info->magic = 0;
+    info->prev = info->next = nullptr;
+}
+
+// is_active(info)
+//    Return true if `info` is the metadata of an active pointer. Besides the
+//    magic number, the neighbors in the list must point back at `info`, so
+//    a copy of a real header does not pass either. O(1). The caller must
+//    hold the lock of `active_list_of(info)`.
+
+static bool is_active(struct attributes* info) {
+    if (info->magic != ((uint32_t) (uintptr_t) info ^ ACTIVE_MAGIC)) {
+      return false;
+    }
+    if (info->prev ? info->prev->next != info : active_list_of(info)->head != info) {
+      return false;
+    }
+    return info->next == nullptr || info->next->prev == info;
+}
+
+
+// The page map indexes every active pointer by the pages of its block. For
+// each 4096-byte page it keeps the blocks that start on the page and the
+// block that covers the page's first byte, if any, so the block containing
+// any address is found by looking at a single page. It also remembers which
+// pages ever held a block: metadata in front of a freed pointer is only read
+// if it lies on such a page, so a wild free can't crash m61_free.
+//
+// The map is a two-level radix tree keyed by page number. Leaves are
+// reserved with mmap when a page in their range is first used.
+
+const int PAGEMAP_SHIFT = 12;
+const uintptr_t PAGEMAP_PAGESIZE = (uintptr_t) 1 << PAGEMAP_SHIFT;
+const int PAGEMAP_LEAF_BITS = 18;
+const int PAGEMAP_ROOT_BITS = 47 - PAGEMAP_SHIFT - PAGEMAP_LEAF_BITS;
+
+// The page map entry of one page.
+struct page_entry {
+  std::atomic<struct attributes*> blocks;   // blocks that start on this page
+  std::atomic<struct attributes*> cover;    // block covering the page start
+  std::atomic<bool> used;                   // some block was ever on the page
+};
+std::atomic<struct page_entry*> pagemap[1 << PAGEMAP_ROOT_BITS];
+
+// Locks for the lists of blocks starting on a page, picked by page number.
+const int NPAGEMAP_LOCKS = 64;
+std::mutex pagemap_locks[NPAGEMAP_LOCKS];
+
+
+// pagemap_entry(addr, create)
+//    Return the page map entry for the page containing `addr`. Returns
+//    nullptr if the page has no entry yet and `create` is false, or if
+//    a leaf can't be reserved.
+
+static struct page_entry* pagemap_entry(uintptr_t addr, bool create) {
+    uintptr_t page = addr >> PAGEMAP_SHIFT;
+    if (page >> (PAGEMAP_ROOT_BITS + PAGEMAP_LEAF_BITS)) {
+      return nullptr;
+    }
+    std::atomic<struct page_entry*>& slot = pagemap[page >> PAGEMAP_LEAF_BITS];
+    struct page_entry* leaf = slot.load(std::memory_order_acquire);
+    if (!leaf && create) {
+      void* m = mmap(nullptr, sizeof(struct page_entry) << PAGEMAP_LEAF_BITS,
+                     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (m == MAP_FAILED) {
+        return nullptr;
+      }
+      if (slot.compare_exchange_strong(leaf, (struct page_entry*) m)) {
+        leaf = (struct page_entry*) m;
+      } else {
+        munmap(m, sizeof(struct page_entry) << PAGEMAP_LEAF_BITS);   // lost a race
+      }
+    }
+    if (!leaf) {
+      return nullptr;
+    }
+    return &leaf[page & ((1UL << PAGEMAP_LEAF_BITS) - 1)];
+}
+
+// pagemap_used(addr)
+//    Return true if the page containing `addr` ever held a block, so reading
+//    memory there is safe.
+
+static inline bool pagemap_used(uintptr_t addr) {
+    struct page_entry* pe = pagemap_entry(addr, false);
+    return pe && pe->used.load(std::memory_order_relaxed);
+}
+
+// pagemap_cover(info, first, last)
+//    Mark pages `first` through `last` (addresses) used, and `info` as the
+//    block covering the start of each of them except the one containing
+//    `first`. Returns false if the page map is out of memory.
+
+static bool pagemap_cover(struct attributes* info, uintptr_t first, uintptr_t last) {
+    for (uintptr_t a = first & ~(PAGEMAP_PAGESIZE - 1); a <= last; a += PAGEMAP_PAGESIZE) {
+      struct page_entry* pe = pagemap_entry(a, true);
+      if (!pe) {
+        return false;
+      }
+      if (a > first) {
+        pe->cover.store(info, std::memory_order_relaxed);
+      }
+      if (!pe->used.load(std::memory_order_relaxed)) {
+        pe->used.store(true, std::memory_order_relaxed);
+      }
+    }
+    return true;
+}
+
+// pagemap_uncover(info, first, last)
+//    Undo pagemap_cover(info, first, last), except that pages stay used.
+
+static void pagemap_uncover(struct attributes* info, uintptr_t first, uintptr_t last) {
+    for (uintptr_t a = (first & ~(PAGEMAP_PAGESIZE - 1)) + PAGEMAP_PAGESIZE; a <= last; a += PAGEMAP_PAGESIZE) {
+      struct page_entry* pe = pagemap_entry(a, false);
+      if (pe && pe->cover.load(std::memory_order_relaxed) == info) {
+        pe->cover.store(nullptr, std::memory_order_relaxed);
+      }
+    }
+}
+
+// pagemap_insert(info, endptr)
+//    Index the block that starts at `info` and ends at `endptr`. O(1) for
+//    blocks that fit in a page. Returns false if out of memory.
+
+static bool pagemap_insert(struct attributes* info, uintptr_t endptr) {
+    if (!pagemap_cover(info, (uintptr_t) info, endptr - 1)) {
+      pagemap_uncover(info, (uintptr_t) info, endptr - 1);
+      return false;
+    }
+    struct page_entry* pe = pagemap_entry((uintptr_t) info, false);
+    mt_guard guard(pagemap_locks[((uintptr_t) info >> PAGEMAP_SHIFT) % NPAGEMAP_LOCKS]);
+    info->page_prev = nullptr;
+    info->page_next = pe->blocks.load(std::memory_order_relaxed);
+    if (info->page_next) {
+      info->page_next->page_prev = info;
+    }
+    pe->blocks.store(info, std::memory_order_relaxed);
+    return true;
+}
+
+// pagemap_erase(info, endptr)
+//    Remove the block that starts at `info` and ends at `endptr` from the
+//    page map.
+
+static void pagemap_erase(struct attributes* info, uintptr_t endptr) {
+    pagemap_uncover(info, (uintptr_t) info, endptr - 1);
+    struct page_entry* pe = pagemap_entry((uintptr_t) info, false);
+    mt_guard guard(pagemap_locks[((uintptr_t) info >> PAGEMAP_SHIFT) % NPAGEMAP_LOCKS]);
+    if (info->page_prev) {
+      info->page_prev->page_next = info->page_next;
+    } else {
+      pe->blocks.store(info->page_next, std::memory_order_relaxed);
+    }
+    if (info->page_next) {
+      info->page_next->page_prev = info->page_prev;
+    }
+}
+
+// pagemap_find(addr)
+//    Return the metadata of the active pointer whose data contains `addr`,
+//    or nullptr if there is none. Only looks at the page of `addr`.
+
+static struct attributes* pagemap_find(uintptr_t addr) {
+    struct page_entry* pe = pagemap_entry(addr, false);
+    if (!pe) {
+      return nullptr;
+    }
+    mt_guard guard(pagemap_locks[(addr >> PAGEMAP_SHIFT) % NPAGEMAP_LOCKS]);
+    struct attributes* info = pe->cover.load(std::memory_order_relaxed);
+    for (struct attributes* b = pe->blocks.load(std::memory_order_relaxed);
+         b; b = b->page_next) {
+      if ((uintptr_t) b < addr && (!info || b > info)) {
+        info = b;   // the last block starting before `addr`
+      }
+    }
+    if (info) {
+      uintptr_t ptr = (uintptr_t) info + METADATA_SIZE;
+      if (addr < ptr || addr >= ptr + info->sz) {
+        return nullptr;
+      }
+    }
+    return info;
+}
+
+
+
+// The slab backend serves small blocks without calling base_malloc. Blocks
+// are grouped into power-of-two size classes; each class carves page-sized
+// slabs out of one big reserved region and keeps its freed blocks on a FIFO
+// free list. Every thread has its own classes, which act as a per-thread
+// cache: only taking a new slab touches shared state. Freed blocks are only reused once a class has SLAB_MIN_FREE of
+// them, so like the base allocator it doesn't reuse memory right away, and
+// double frees and wild writes are still caught.
+
+const size_t SLAB_PAGESIZE = 4096;
+const int SLAB_MIN_SHIFT = 6;         // the smallest class holds 64 bytes
+const int SLAB_NCLASSES = 6;          // the largest class holds 2048 bytes
+const size_t SLAB_MIN_FREE = 64;
+const size_t SLAB_REGION_SIZE = (size_t) 1 << 32;
+
+// A size class of the slab backend.
+struct slab_class {
+  struct attributes* free_head;   // oldest freed block
+  struct attributes* free_tail;   // newest freed block
+  size_t nfree;                   // number of blocks on the free list
+  uintptr_t carve;                // next unused block in the current slab
+  uintptr_t carve_end;            // end of the current slab
+};
+thread_local struct slab_class slabs[SLAB_NCLASSES];
+
+// The region that slabs come from; `slab_next` is its first unused page.
+uintptr_t slab_region = 0;
+uintptr_t slab_region_end = 0;
+std::atomic<uintptr_t> slab_next(0);
+
+// Protects the base allocator, which is not thread-safe.
+std::mutex base_lock;
+
+
+// Guard mode (M61_GUARD) ends each big block right before a PROT_NONE page,
+// so a write past the end traps at the faulting instruction instead of
+// being found at free time. Blocks come from one big region reserved with
+// PROT_NONE: a new block makes its pages accessible with one mprotect, and
+// the page after them stays inaccessible. Freed blocks go to a pool for
+// their size class and are reused once GUARD_MIN_FREE more are waiting, so
+// most allocations need no system call at all.
+//
+// Since each guarded block has pages of its own, guard mode changes some
+// behavior the tests check: a program that reads outside its blocks, like
+// test040's wild copy, faults instead of reading neighboring blocks; the
+// fragmentation report sees each block as a region of its own, with no
+// gaps (test056); and m61_realloc resizes a guarded block in place only
+// within its 16-byte alignment, since guarded blocks get no slack.
+
+const int GUARD_NCLASSES = 40;
+const size_t GUARD_MIN_FREE = 8;
+const size_t GUARD_REGION_SIZE = (size_t) 1 << 40;
+
+// The region that guarded blocks come from; `guard_next` is its first
+// unused page. `guard_pool[c]` holds the guard page addresses of freed
+// blocks of class `c`, oldest first. The pools are allocated when guard
+// mode turns on, since an empty std::deque already allocates memory.
+uintptr_t guard_region = 0;
+uintptr_t guard_region_end = 0;
+uintptr_t guard_next = 0;
+std::deque<uintptr_t>* guard_pool;
+std::mutex guard_lock;
+
+
+// load_options()
+//    Read runtime options from the environment into `opts`, and reserve the
+//    slab and guard regions if they are on.
+
+static void load_options() {
+    const char* s = getenv("M61_SLAB");
+    opts.slab = s && strcmp(s, "0") != 0;
+    s = getenv("M61_THREADS");
+    opts.threads = s ? strcmp(s, "0") != 0 : m61_default_threads;
+    s = getenv("M61_HH_K");
+    opts.hh_k = s ? strtoul(s, nullptr, 0) : 0;
+    s = getenv("M61_SAMPLE");
+    opts.sample_interval = s ? strtoul(s, nullptr, 0) : 0;
+    start_time = now();
+    sites_open();
+    s = getenv("M61_TRACE");
+    if (s) {
+      const char* n = getenv("M61_TRACE_RECORDS");   // ring buffer size
+      size_t nrecords = n ? strtoul(n, nullptr, 0) : 0;
+      opts.trace = trace_open(s, nrecords ? nrecords : (size_t) 1 << 20);
+    }
+
+    s = getenv("M61_GUARD");
+    opts.guard = s ? strtoul(s, nullptr, 0) : 0;
+    s = getenv("M61_POISON");
+    opts.poison = s && strcmp(s, "0") != 0;
+    s = getenv("M61_QUARANTINE");
+    opts.quarantine = s ? strtoul(s, nullptr, 0) : 0;
+    opts.poison = opts.poison || opts.quarantine;
+    s = getenv("M61_REDZONE");
+    if (s) {
+      size_t n = std::min((size_t) strtoul(s, nullptr, 0), MAX_REDZONE);
+      LEADING_REDZONE = TRAILING_REDZONE = (n + 15) & ~(size_t) 15;
+      METADATA_SIZE += LEADING_REDZONE;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+      bytes_equal = bytes_equal_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+      bytes_equal = bytes_equal_sse2;
+    }
+#endif
+
+    if (opts.guard) {
+      void* region = mmap(nullptr, GUARD_REGION_SIZE, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (region == MAP_FAILED) {
+        opts.guard = 0;
+      } else {
+        guard_region = guard_next = (uintptr_t) region;
+        guard_region_end = guard_region + GUARD_REGION_SIZE;
+        guard_pool = new std::deque<uintptr_t>[GUARD_NCLASSES];
+      }
+    }
+    if (opts.slab) {
+      void* region = mmap(nullptr, SLAB_REGION_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (region == MAP_FAILED) {
+        opts.slab = false;
+      } else {
+        slab_region = (uintptr_t) region;
+        slab_region_end = slab_region + SLAB_REGION_SIZE;
+        slab_next = slab_region;
+      }
+    }
+}
+
+// load_options_once()
+//    Call load_options() the first time m61 is used.
+
+static inline void load_options_once() {
+    static bool loaded = (load_options(), true);  // once, even with threads
+    (void) loaded;
+}
+
+
+// slab_class_of(blocksz)
+//    Return the size class for a block of `blocksz` bytes, or -1 if the
+//    block is too big for the slab backend.
+
+static int slab_class_of(size_t blocksz) {
+    if (blocksz > ((size_t) 1 << (SLAB_MIN_SHIFT + SLAB_NCLASSES - 1))) {
+      return -1;
+    }
+    if (blocksz <= ((size_t) 1 << SLAB_MIN_SHIFT)) {
+      return 0;
+    }
+    return 64 - __builtin_clzl(blocksz - 1) - SLAB_MIN_SHIFT;
+}
+
+// slab_malloc(blocksz)
+//    Return a block of at least `blocksz` bytes from the slab backend, or
+//    nullptr if the block must come from base_malloc instead.
+
+static void* slab_malloc(size_t blocksz) {
+    int c = slab_class_of(blocksz);
+    if (c < 0) {
+      return nullptr;
+    }
+    struct slab_class* sc = &slabs[c];
+
+    // reuse the oldest freed block once enough are waiting
+    if (sc->nfree > SLAB_MIN_FREE) {
+      struct attributes* block = sc->free_head;
+      sc->free_head = block->next;
+      sc->nfree--;
+      return block;
+    }
+
+    // otherwise carve a new block, taking a new slab if necessary
+    if (sc->carve == sc->carve_end) {
+      uintptr_t page = slab_next.fetch_add(SLAB_PAGESIZE, std::memory_order_relaxed);
+      if (page >= slab_region_end) {
+        return nullptr;
+      }
+      sc->carve = page;
+      sc->carve_end = page + SLAB_PAGESIZE;
+    }
+    void* block = (void*) sc->carve;
+    sc->carve += (size_t) 1 << (SLAB_MIN_SHIFT + c);
+    return block;
+}
+
+// slab_owns(metaptr)
+//    Return true if `metaptr` came from the slab backend.
+
+static inline bool slab_owns(void* metaptr) {
+    return (uintptr_t) metaptr >= slab_region && (uintptr_t) metaptr < slab_region_end;
+}
+
+// slab_free(metaptr, blocksz)
+//    Return the `blocksz`-byte block `metaptr` to the back of its free list.
+//    Blocks freed by another thread than the one that allocated them just
+//    move to the freeing thread's list.
+
+static void slab_free(struct attributes* metaptr, size_t blocksz) {
+    struct slab_class* sc = &slabs[slab_class_of(blocksz)];
+    metaptr->next = nullptr;
+    if (sc->nfree) {
+      sc->free_tail->next = metaptr;
+    } else {
+      sc->free_head = metaptr;
+    }
+    sc->free_tail = metaptr;
+    sc->nfree++;
+}
+
+
+// guard_class_of(blocksz)
+//    Return the guard mode size class for a block of `blocksz` bytes. Class
+//    `c` blocks get guard_class_pages(c) pages: 1 to 16 pages go up one page
+//    at a time, bigger blocks by powers of two.
+
+static int guard_class_of(size_t blocksz) {
+    size_t npages = (blocksz + 15 + SLAB_PAGESIZE - 1) / SLAB_PAGESIZE;
+    if (npages <= 16) {
+      return npages - 1;
+    }
+    return 64 - __builtin_clzl(npages - 1) - 5 + 16;
+}
+
+static inline size_t guard_class_pages(int c) {
+    return c < 16 ? c + 1 : (size_t) 1 << (c - 11);
+}
+
+// guard_malloc(blocksz)
+//    Return a block of `blocksz` bytes that ends at most 15 bytes before a
+//    guard page, or nullptr if the guard region is used up.
+
+static void* guard_malloc(size_t blocksz) {
+    if (blocksz > GUARD_REGION_SIZE) {
+      return nullptr;
+    }
+    int c = guard_class_of(blocksz);
+    if (c >= GUARD_NCLASSES) {
+      return nullptr;
+    }
+    size_t len = guard_class_pages(c) * SLAB_PAGESIZE;
+
+    mt_guard guard(guard_lock);
+    uintptr_t guard_page;
+    if (guard_pool[c].size() > GUARD_MIN_FREE) {
+      guard_page = guard_pool[c].front();
+      guard_pool[c].pop_front();
+    } else {
+      if (guard_region_end - guard_next < len + SLAB_PAGESIZE
+          || mprotect((void*) guard_next, len, PROT_READ | PROT_WRITE) != 0) {
+        return nullptr;
+      }
+      guard_page = guard_next + len;
+      guard_next = guard_page + SLAB_PAGESIZE;    // skip the guard page
+    }
+    return (void*) ((guard_page - blocksz) & ~(uintptr_t) 15);
+}
+
+// guard_owns(block)
+//    Return true if `block` came from guard_malloc.
+
+static inline bool guard_owns(void* block) {
+    return (uintptr_t) block >= guard_region && (uintptr_t) block < guard_region_end;
+}
+
+// guard_free(block, blocksz)
+//    Return the `blocksz`-byte guarded block `block` to the pool.
+
+static void guard_free(void* block, size_t blocksz) {
+    uintptr_t guard_page = ((uintptr_t) block + blocksz + SLAB_PAGESIZE - 1) & ~(SLAB_PAGESIZE - 1);
+    mt_guard guard(guard_lock);
+    guard_pool[guard_class_of(blocksz)].push_back(guard_page);
+}
+
+
+// block_capacity(sz)
+//    Return the number of data bytes reserved for a pointer of `sz` bytes.
+//    Capacities go up in steps of a quarter of the size, so a block has up
+//    to 25% slack that m61_realloc can grow into without copying. Since the
+//    capacity only depends on the size, it needs no room in the header. For
+//    sizes between `sz` and `block_capacity(sz)` the capacity stays the same,
+//    but a smaller size can have a smaller capacity.
+//    In guard mode, a block whose slack would make it big enough for
+//    block_malloc to guard gets no slack instead, so the guard page is as
+//    close to the data as alignment allows.
+
+static inline size_t block_capacity(size_t sz) {
+    size_t cap;
+    if (sz <= 64) {
+      cap = (sz + 15) & ~(size_t) 15;
+    } else {
+      size_t step = ((size_t) 1 << (63 - __builtin_clzl(sz - 1))) / 4;
+      cap = (sz + step - 1) & ~(step - 1);
+    }
+    if (opts.guard && METADATA_SIZE + cap + TRAILING_REDZONE >= opts.guard) {
+      cap = ((sz + TRAILING_REDZONE + 15) & ~(size_t) 15) - TRAILING_REDZONE;
+    }
+    return cap;
+}
+
+// block_size(sz)
+//    Return the size of the block that holds a pointer of `sz` bytes.
+
+static inline size_t block_size(size_t sz) {
+    return METADATA_SIZE + block_capacity(sz) + TRAILING_REDZONE;
+}
+
+// block_malloc(blocksz)
+//    Return a block of `blocksz` bytes from guard mode if it is on and the
+//    block is big enough, from the slab backend if it is on and the block
+//    is small enough, or from the base allocator.
+
+static void* block_malloc(size_t blocksz) {
+    void* block = nullptr;
+    if (opts.guard && blocksz >= opts.guard) {
+      block = guard_malloc(blocksz);
+    }
+    if (block == nullptr && opts.slab) {
+      block = slab_malloc(blocksz);
+    }
+    if (block == nullptr) {
+      mt_guard guard(base_lock);
+      block = base_malloc(blocksz);
+    }
+    return block;
+}
+
+// block_free(block, blocksz)
+//    Free a `blocksz`-byte block returned by block_malloc.
+
+static void block_free(void* block, size_t blocksz) {
+    if (guard_owns(block)) {
+      guard_free(block, blocksz);
+    } else if (slab_owns(block)) {
+      slab_free((struct attributes*) block, blocksz);
+    } else {
+      mt_guard guard(base_lock);
+      base_free(block);
+    }
+}
+
+
+// With M61_QUARANTINE=n, freed blocks are poisoned and held in a FIFO
+// instead of being freed, so a write through a dangling pointer has time to
+// land in poison. Once the held blocks add up to more than n bytes, the
+// oldest are evicted, up to QUARANTINE_BATCH at a time, until they are
+// under 7/8 of n. Evicted blocks are checked for writes after free as a
+// batch, outside the lock, and then really freed.
+
+struct quarantined {
+  void* block;
+  size_t blocksz;
+  void* ptr;                // the freed pointer
+  size_t sz;
+  const char* file;         // where it was freed
+  long line;
+};
+
+const size_t QUARANTINE_BATCH = 32;
+std::deque<quarantined>* quarantine;   // allocated on first use
+size_t quarantine_size = 0;     // sum of `blocksz` in `quarantine`
+std::mutex quarantine_lock;
+
+// quarantine_check(q)
+//    Abort if the poisoned data of the quarantined block `q` was changed.
+
+static void quarantine_check(const quarantined& q) {
+    const unsigned char* p = (const unsigned char*) q.ptr;
+    if (bytes_equal(p, q.sz, POISON_BYTE)) {
+      return;
+    }
+    size_t off = 0;
+    while (p[off] == POISON_BYTE) {
+      ++off;
+    }
+    fprintf(stderr, "MEMORY BUG: detected write to freed pointer %p\n", q.ptr);
+    fprintf(stderr, "%s: %p is %zu bytes inside a %zu byte region freed here\n",
+            site_name(q.file, q.line).c_str(), p + off, off, q.sz);
+    abort();
+}
+
+// quarantine_free(block, blocksz, ptr, sz, file, line)
+//    Put the `blocksz`-byte block holding the freed pointer `ptr` of `sz`
+//    bytes, already poisoned, in the quarantine, and evict old blocks if it
+//    is over budget.
+
+static void quarantine_free(void* block, size_t blocksz, void* ptr, size_t sz,
+                            const char* file, long line) {
+    quarantined batch[QUARANTINE_BATCH];
+    size_t n = 0;
+    {
+      mt_guard guard(quarantine_lock);
+      if (!quarantine) {
+        quarantine = new std::deque<quarantined>;
+      }
+      quarantine->push_back({block, blocksz, ptr, sz, file, line});
+      quarantine_size += blocksz;
+      if (quarantine_size > opts.quarantine) {
+        size_t low = opts.quarantine - opts.quarantine / 8;
+        while (n < QUARANTINE_BATCH && quarantine_size > low) {
+          batch[n] = quarantine->front();
+          quarantine->pop_front();
+          quarantine_size -= batch[n].blocksz;
+          ++n;
+        }
+      }
+    }
+
+    for (size_t i = 0; i != n; ++i) {
+      quarantine_check(batch[i]);
+    }
+    for (size_t i = 0; i != n; ++i) {
+      block_free(batch[i].block, batch[i].blocksz);
+    }
+}
+
+
+// In sampling mode (M61_SAMPLE=n), each thread counts down the bytes it
+// allocates, and only the allocation that crosses zero is tracked with full
+// attributes; the countdown then restarts from an exponentially distributed
+// value with mean n. So an allocation of `sz` bytes is sampled with
+// probability 1 - exp(-sz/n), and big allocations are rarely missed. Other
+// allocations get a LIGHT_HEADER_SIZE header holding only the size and a
+// tag that marks the block as light:
+
+/* Memory layout of a light block
+
+      +----------+ <- block
+      |    SZ    | (8 bytes)
+      |   TAG    | (8 bytes, ptr XOR LIGHT_MAGIC)
+      +----------+ <- ptr
+      |   DATA   | (sz)
+      +----------|
+*/
+
+const size_t LIGHT_HEADER_SIZE = 16;
+
+// Values mixed into the tag of light blocks. Their high bits make the tag a
+// non-canonical address, so a full header never ends in a matching word.
+const uintptr_t LIGHT_MAGIC = 0x5A4D9C1E00000000UL;
+const uintptr_t LIGHT_FREED_MAGIC = 0xF8EED5A4D9C10000UL;
+
+
+// is_light(ptr)
+//    Return true if `ptr` is an active light block.
+
+static inline bool is_light(void* ptr) {
+    return opts.sample_interval
+      && ((uintptr_t*) ptr)[-1] == ((uintptr_t) ptr ^ LIGHT_MAGIC);
+}
+
+// sample_random(shard)
+//    Return a random number uniformly distributed in (0, 1).
+
+static double sample_random(struct stats_shard* shard) {
+    uint64_t x = shard->sample_random;
+    if (x == 0) {
+      x = 0x9E3779B97F4A7C15UL ^ (uintptr_t) shard;
+    }
+    x ^= x << 13;   // xorshift64
+    x ^= x >> 7;
+    x ^= x << 17;
+    shard->sample_random = x;
+    return ((x >> 11) + 0.5) / 9007199254740992.0;
+}
+
+// next_sample_interval(shard)
+//    Return the number of bytes until the next sample, drawn from an
+//    exponential distribution with mean `opts.sample_interval`.
+
+static size_t next_sample_interval(struct stats_shard* shard) {
+    return (size_t) (-log(sample_random(shard)) * opts.sample_interval) + 1;
+}
+
+// sample_weight(sz)
+//    Return the number of bytes that a sampled allocation of `sz` bytes
+//    stands for: `sz` divided by the chance that it was sampled.
+
+static double sample_weight(size_t sz) {
+    if (sz == 0) {
+      return 0;
+    }
+    return sz / -expm1(-(double) sz / opts.sample_interval);
+}
+
+// light_malloc(shard, sz, file, line)
+//    Allocate an unsampled block of `sz` bytes at `file`:`line`. Only
+//    counts statistics.
+
+static void* light_malloc(struct stats_shard* shard, size_t sz, const char* file, long line) {
+    uintptr_t* block = (uintptr_t*) block_malloc(LIGHT_HEADER_SIZE + block_capacity(sz));
+    if (block == nullptr) {
+      record_fail(sz, file, line);
+      return 0;
+    }
+    uintptr_t ptr = (uintptr_t) block + LIGHT_HEADER_SIZE;
+    if (!pagemap_cover(nullptr, (uintptr_t) block, ptr + block_capacity(sz) - 1)) {
+      block_free(block, LIGHT_HEADER_SIZE + block_capacity(sz));
+      record_fail(sz, file, line);
+      return 0;
+    }
+    block[0] = sz;
+    block[1] = ptr ^ LIGHT_MAGIC;
 
-// The total number of freed pointers.
-int nfree;
+    record_malloc(shard, sz);
+    extend_heap(ptr, ptr + sz);
+    if (opts.trace) {
+      trace_record(M61_TRACE_MALLOC, ptr, sz, file, line);
+    }
+    return (void*) ptr;
+}
 
-// The total size of all freed allocations.
-int free_size;
+// light_free(ptr, file, line)
+//    Free the light block `ptr` at `file`:`line`.
 
-// A constant used for the alignment of metadata.
-size_t METADATA_SIZE = (size_t) alignof(std::max_align_t);
+static void light_free(void* ptr, const char* file, long line) {
+    uintptr_t* block = (uintptr_t*) ((uintptr_t) ptr - LIGHT_HEADER_SIZE);
+    size_t sz = block[0];
+    block[1] = (uintptr_t) ptr ^ LIGHT_FREED_MAGIC;   // to detect double free
+    if (opts.poison) {
+      memset(ptr, POISON_BYTE, sz);
+    }
 
-// The largest integer. Used as a special value to indicate a freed pointer.
-size_t LARGEST_INT = (size_t)-1;
+    record_free(get_shard(), sz);
+    if (opts.trace) {
+      trace_record(M61_TRACE_FREE, (uintptr_t) ptr, sz, file, line);
+    }
+    if (opts.quarantine) {
+      quarantine_free(block, LIGHT_HEADER_SIZE + block_capacity(sz), ptr, sz, file, line);
+    } else {
+      block_free(block, LIGHT_HEADER_SIZE + block_capacity(sz));
+    }
+}
 
-// A set containing all active pointers allocated through m61_malloc().
-std::set<void*> active_ptr;
 
-// A structure that describes all attributes of a pointer.
-struct attributes {
-  const char* file;
-  long line;
-  size_t sz;
-};
+// sampled_bytes(shard, sz)
+//    Return the number of bytes to count for a sampled allocation of `sz`
+//    bytes, rounding its weight up or down at random so sums stay unbiased.
 
-// A map that maps active pointers allocated by m61_malloc() to its according attributes
-std::unordered_map <void*, struct attributes> ptrmap;
+static size_t sampled_bytes(struct stats_shard* shard, size_t sz) {
+    double weight = sample_weight(sz);
+    size_t bytes = (size_t) weight;
+    if (sample_random(shard) < weight - bytes) {
+      bytes++;
+    }
+    return bytes;
+}
 
-// A map that maps file names to another dictionary whose keys are lines and values are total sizes of allocation.
-std::unordered_map <const char*, std::unordered_map <long, size_t>> hhmap;
+// record_heavy_hitter(shard, site, file, line, sz)
+//    Count `sz` bytes allocated at `file`:`line`, whose id is `site`. The
+//    exact count is one add to the site's counter; `hhmap` only holds sites
+//    that didn't fit in the site table.
 
+static void record_heavy_hitter(struct stats_shard* shard, uint32_t site,
+                                const char* file, long line, size_t sz) {
+    if (!opts.hh_k && site != NOSITE) {
+      add_shared(sites[site].total_size, sz);
+      return;
+    }
+    mt_guard guard(shard->hhlock);
+    hhmap_type& hhmap = shard->hhmap;
+    if (opts.hh_k) {
+      if (!shard->hhsummary.heap) {
+        hh_summary_init(&shard->hhsummary, opts.hh_k);
+      }
+      hh_summary_add(&shard->hhsummary, file, line, sz);
+    } else {
+      hhmap[file][line] += sz;      // adds the file and line if they're new
+    }
+}
 
-/// m61_malloc(sz, file, line)
-///    Return a pointer to `sz` bytes of newly-allocated dynamic memory.
-///    The memory is not initialized. If `sz == 0`, then m61_malloc must
-///    return a unique, newly-allocated pointer value. The allocation
-///    request was at location `file`:`line`.
 
-void* m61_malloc(size_t sz, const char* file, long line) {
-    (void) file, (void) line;   // avoid uninitialized variable warnings
+// malloc_at(sz, file, line, site)
+//    Like m61_malloc, for a caller that may know the id of `file`:`line`
+//    already. If `site` is UNKNOWN_SITE, it is looked up when needed.
 
-    if (METADATA_SIZE+sz <= sz) { //avoid integer overflow
-      mystats.nfail++;
-      mystats.fail_size += sz;
+static void* malloc_at(size_t sz, const char* file, long line, uint32_t site) {
+    load_options_once();
+
+    if (block_size(sz) <= sz) { //avoid integer overflow
+      record_fail(sz, file, line);
       return 0;
     }
 
-    size_t* metaptr = (size_t*) base_malloc(2*METADATA_SIZE+ sz); //metaptr points to the begining
+    struct stats_shard* shard = get_shard();
+    size_t hhsz = sz;
+    if (opts.sample_interval) {
+      if (sz < shard->bytes_until_sample) {
+        shard->bytes_until_sample -= sz;
+        return light_malloc(shard, sz, file, line);
+      }
+      shard->bytes_until_sample = next_sample_interval(shard);
+      hhsz = sampled_bytes(shard, sz);
+    }
+
+    //metaptr points to the begining
+    struct attributes* metaptr = (struct attributes*) block_malloc(block_size(sz));
 
     if (metaptr == nullptr) {
-      mystats.nfail++;
-      mystats.fail_size += sz;
+      record_fail(sz, file, line);
       return 0;
     }
 
     /* Memory layout
 
       +----------+ <- metaptr
-      |    SZ    | (16 bytes)
+      |   FILE   | (METADATA_SIZE bytes)
+      |   LINE   |
+      |    SZ    |
+      |MAGIC,SITE|
+      |PREV, NEXT|
+      |PAGE LINKS|
+      | -------- |
+      |   0xAB   | (LEADING_REDZONE bytes)
       +----------+ <- ptr
       |   DATA   | (sz)
       |          |
       | -------- | <- endptr
-      |   0xAB   | (8 bytes of padding with magic#)
+      |   0xAB   | (TRAILING_REDZONE bytes)
+      | -------- |
+      |  SLACK   | (block_capacity(sz) - sz)
       +----------|
     */
-    *metaptr = sz;
+    metaptr->file = file;       // document the attributes
+    metaptr->line = line;
+    metaptr->sz = sz;
+    metaptr->site = site == UNKNOWN_SITE ? site_id(file, line) : site;
+
     uintptr_t ptr = (uintptr_t) metaptr + METADATA_SIZE;
     uintptr_t endptr = ptr + sz;
-    memset((void*)endptr, 0xAB, 8);
-
-    mystats.ntotal++;
-    mystats.total_size += sz;
-
-    if (mystats.heap_min != 0) {
-      if (ptr < mystats.heap_min) {
-        mystats.heap_min = ptr;
-      }
-    }
-    else {
-      mystats.heap_min = ptr;
-    }
-
-    if ((uintptr_t)endptr > mystats.heap_max) {
-      mystats.heap_max = (uintptr_t)endptr;
+    if (!pagemap_insert(metaptr, (uintptr_t) metaptr + block_size(sz))) {
+      block_free(metaptr, block_size(sz));
+      record_fail(sz, file, line);
+      return 0;
     }
+    active_insert(metaptr);     // link ptr into the active pointer list
+    memset((void*) (ptr - LEADING_REDZONE), REDZONE_BYTE, LEADING_REDZONE);
+    memset((void*) endptr, REDZONE_BYTE, TRAILING_REDZONE);
 
-    active_ptr.insert((void*)ptr);              // insert ptr to active_ptr set
+    record_malloc(shard, sz);
+    record_site(metaptr->site, sz, 1);
 
-    struct attributes info = {file, line, sz};  // document the attributes
-    ptrmap.insert({(void*) ptr, info});         // insert ptr and its attributes into ptrmap
+    extend_heap(ptr, endptr);
 
     // collect heavy hitter information
-    if (hhmap.count(file) > 0) {
-      if (hhmap.find(file)->second.count(line) > 0) {       // if file & line both exist
-        hhmap.find(file)->second.find(line)->second += sz;  // increment size by `sz`
-      }
-      else {                                            // if line doesn't exist
-        hhmap.find(file)->second.insert({ line, sz });  // insert new key-value pair into lineMap
-      }
-    } else {                                     // if file & line don't exist
-      std::unordered_map<long, size_t> lineMap;  // create a new lineMap
-      lineMap.insert({ line, sz });              // insert new pair into lineMap
-      hhmap.insert({ file, lineMap });           // insert new pair into hhmap
+    record_heavy_hitter(shard, metaptr->site, file, line, hhsz);
+    if (opts.trace) {
+      trace_record(M61_TRACE_MALLOC, ptr, sz, file, line);
     }
 
     return (void*) ptr;
 }
 
-/// m61_free(ptr, file, line)
-///    Free the memory space pointed to by `ptr`, which must have been
-///    returned by a previous call to m61_malloc. If `ptr == NULL`,
-///    does nothing. The free was called at location `file`:`line`.
+/// m61_malloc(sz, file, line)
+///    Return a pointer to `sz` bytes of newly-allocated dynamic memory.
+///    The memory is not initialized. If `sz == 0`, then m61_malloc must
+///    return a unique, newly-allocated pointer value. The allocation
+///    request was at location `file`:`line`.
 
-void m61_free(void* ptr, const char* file, long line) {
-    (void) file, (void) line;   // avoid uninitialized variable warnings
+void* m61_malloc(size_t sz, const char* file, long line) {
+    return malloc_at(sz, file, line, UNKNOWN_SITE);
+}
 
-    if (ptr == 0) {
-      return;
-    }
+// check_in_heap(ptr, file, line)
+//    Abort with a message if `ptr` can't be a pointer returned by m61_malloc,
+//    or is a light block that was already freed.
 
-    if ((uintptr_t)ptr < mystats.heap_min || (uintptr_t)ptr > mystats.heap_max) {
+static void check_in_heap(void* ptr, const char* file, long line) {
+    if ((uintptr_t)ptr < heap_min.load(std::memory_order_relaxed)
+        || (uintptr_t)ptr > heap_max.load(std::memory_order_relaxed)) {
       // ptr not in heap
-      fprintf(stderr, "MEMORY BUG: %s:%ld: invalid free of pointer %p, not in heap\n", file, line, ptr);
+      fprintf(stderr, "MEMORY BUG: %s: invalid free of pointer %p, not in heap\n",
+              site_name(file, line).c_str(), ptr);
       abort();
     }
 
-    /* Memory layout
-
-      +----------+ <- metaptr
-      |    SZ    | (16 bytes)
-      +----------+ <- ptr
-      |   DATA   | (sz)
-      |          |
-      | -------- | <- endptr
-      |   0xAB   | (8 bytes of padding with magic#)
-      +----------|
-    */
-    size_t* metaptr = (size_t*)((uintptr_t)ptr - METADATA_SIZE); // retrive metaptr
-    size_t sz;                                                   // retrive size
-    memcpy((void*) &sz, (void*) metaptr, sizeof(size_t));
-    char* endptr = (char*) ((uintptr_t) ptr + sz);               // retrive endptr
-
-    if (sz == LARGEST_INT) {
-      // ptr double free
-      fprintf(stderr, "MEMORY BUG: %s.%ld: invalid free of pointer %p, double free\n", file, line, ptr);
+    if (!pagemap_used((uintptr_t) ptr - LIGHT_HEADER_SIZE)) {
+      // no block was ever there, so don't look at the memory before ptr
+      fprintf(stderr, "MEMORY BUG: %s: invalid free of pointer %p, not allocated\n",
+              site_name(file, line).c_str(), ptr);
       abort();
     }
 
-    if (active_ptr.count((void*)ptr) == 0) {
-      // ptr not in the set of active pointers
-      fprintf(stderr, "MEMORY BUG: %s:%ld: invalid free of pointer %p, not allocated\n", file, line, ptr);
-
-      std::set<void*>::iterator setIt = active_ptr.begin();
+    if (opts.sample_interval
+        && ((uintptr_t*) ptr)[-1] == ((uintptr_t) ptr ^ LIGHT_FREED_MAGIC)) {
+      // light ptr double free
+      fprintf(stderr, "MEMORY BUG: %s: invalid free of pointer %p, double free\n",
+              site_name(file, line, '.').c_str(), ptr);
+      abort();
+    }
+}
 
-      // loop through all pointers currently in the active pointer set
-      for (unsigned long i = 0; i < active_ptr.size(); i++) {
-        struct attributes info = ptrmap.find((void*) *setIt)->second;
+// check_active(metaptr, file, line)
+//    Abort with a message unless `metaptr` is the metadata of an active
+//    pointer whose padding is intact. The caller must hold the lock of
+//    `active_list_of(metaptr)`.
 
-        if ((uintptr_t)*setIt < (uintptr_t)ptr && (uintptr_t)*setIt+info.sz > (uintptr_t)ptr) {
-          // ptr is inside an allocated region
-          size_t inside_sz =  (uintptr_t)ptr - (uintptr_t)*setIt; // find inside size
-          fprintf(stderr, "%s:%ld: %p is %lu bytes inside a %lu byte region allocated here\n",
-            info.file, info.line, ptr, inside_sz, info.sz);
-          }
+static void check_active(struct attributes* metaptr, const char* file, long line) {
+    void* ptr = (void*) ((uintptr_t) metaptr + METADATA_SIZE);
+    bool readable = pagemap_used((uintptr_t) metaptr);
 
-        setIt++;
-      }
+    if (readable && metaptr->sz == LARGEST_INT) {
+      // ptr double free
+      fprintf(stderr, "MEMORY BUG: %s: invalid free of pointer %p, double free\n",
+              site_name(file, line, '.').c_str(), ptr);
       abort();
     }
 
-    bool overwritePadding = false;
-    for (int i = 0; i < 8; i++) {
-      if ((char) *(endptr + i) != (char) 0xAB) {
-        overwritePadding = true;
-        break;
+    if (!readable || !is_active(metaptr)) {
+      // ptr not in the list of active pointers
+      fprintf(stderr, "MEMORY BUG: %s: invalid free of pointer %p, not allocated\n",
+              site_name(file, line).c_str(), ptr);
+
+      // look up the active pointer containing ptr in the page map
+      if (struct attributes* info = pagemap_find((uintptr_t) ptr)) {
+        // ptr is inside an allocated region
+        size_t inside_sz = (uintptr_t) ptr - ((uintptr_t) info + METADATA_SIZE);
+        fprintf(stderr, "%s: %p is %lu bytes inside a %lu byte region allocated here\n",
+          site_name(info->file, info->line).c_str(), ptr, inside_sz, info->sz);
       }
+      abort();
     }
 
-    if (overwritePadding) {
+    const unsigned char* endptr = (const unsigned char*) ptr + metaptr->sz;   // retrive endptr
+
+    if (!bytes_equal(endptr, TRAILING_REDZONE, REDZONE_BYTE)
+        || !bytes_equal((const unsigned char*) ptr - LEADING_REDZONE, LEADING_REDZONE, REDZONE_BYTE)) {
       // boundary write errors
-      fprintf(stderr, "MEMORY BUG: %s.%ld: detected wild write during free of pointer %p\n", file, line, ptr);
+      fprintf(stderr, "MEMORY BUG: %s: detected wild write during free of pointer %p\n",
+              site_name(file, line, '.').c_str(), ptr);
       abort();
     }
+}
+
+/// m61_free(ptr, file, line)
+///    Free the memory space pointed to by `ptr`, which must have been
+///    returned by a previous call to m61_malloc. If `ptr == NULL`,
+///    does nothing. The free was called at location `file`:`line`.
+
+void m61_free(void* ptr, const char* file, long line) {
+    (void) file, (void) line;   // avoid uninitialized variable warnings
+
+    if (ptr == 0) {
+      return;
+    }
 
-    nfree++;
-    mystats.nactive = mystats.ntotal - nfree;
-    free_size += sz;
-    mystats.active_size = mystats.total_size - free_size;
+    check_in_heap(ptr, file, line);
+    if (is_light(ptr)) {
+      light_free(ptr, file, line);
+      return;
+    }
+
+    // retrive metaptr, see the memory layout in m61_malloc
+    struct attributes* metaptr = (struct attributes*)((uintptr_t)ptr - METADATA_SIZE);
+    mt_guard guard(active_list_of(metaptr)->lock);
+    check_active(metaptr, file, line);
+    size_t sz = metaptr->sz;
+    uint32_t site = metaptr->site;
+
+    active_erase(metaptr);          // unlink freed ptr from the active pointer list
+    metaptr->sz = LARGEST_INT;      // change metadata to detect double free
+    guard.unlock();
+    pagemap_erase(metaptr, (uintptr_t) metaptr + block_size(sz));
+    if (opts.poison) {
+      memset(ptr, POISON_BYTE, sz);
+    }
 
-    active_ptr.erase((void*)ptr);   // erase freed ptr from active_ptr set
-    ptrmap.erase(ptr);              // erase freed ptr from ptrmap
-    *metaptr = LARGEST_INT;         // change metadata to detect double free
+    record_free(get_shard(), sz);
+    record_site(site, sz, -1);
+    if (opts.trace) {
+      trace_record(M61_TRACE_FREE, (uintptr_t) ptr, sz, file, line);
+    }
 
-    base_free((void*) metaptr);
+    if (opts.quarantine) {
+      quarantine_free(metaptr, block_size(sz), ptr, sz, file, line);
+    } else {
+      block_free(metaptr, block_size(sz));
+    }
 }
 
-/// m61_calloc(nmemb, sz, file, line)
-///    Return a pointer to newly-allocated dynamic memory big enough to
-///    hold an array of `nmemb` elements of `sz` bytes each. If `sz == 0`,
-///    then must return a unique, newly-allocated pointer value. Returned
-///    memory should be initialized to zero. The allocation request was at
-///    location `file`:`line`.
+// calloc_at(nmemb, sz, file, line, site)
+//    Like m61_calloc, for a caller that may know the id of `file`:`line`
+//    already; see malloc_at.
 
-void* m61_calloc(size_t nmemb, size_t sz, const char* file, long line) {
+static void* calloc_at(size_t nmemb, size_t sz, const char* file, long line, uint32_t site) {
 
     if (nmemb * sz / sz != nmemb) { // avoid overflow
-      mystats.nfail++;
-      mystats.fail_size += sz;
+      record_fail(sz, file, line);
       return 0;
     }
-    void* ptr = m61_malloc(nmemb * sz, file, line);
+    void* ptr = malloc_at(nmemb * sz, file, line, site);
     if (ptr) {
         memset(ptr, 0, nmemb * sz);
     }
 
-    mystats.nactive = mystats.ntotal;
-    mystats.active_size = mystats.total_size;
-
     return ptr;
 }
 
+/// m61_calloc(nmemb, sz, file, line)
+///    Return a pointer to newly-allocated dynamic memory big enough to
+///    hold an array of `nmemb` elements of `sz` bytes each. If `sz == 0`,
+///    then must return a unique, newly-allocated pointer value. Returned
+///    memory should be initialized to zero. The allocation request was at
+///    location `file`:`line`.
+
+void* m61_calloc(size_t nmemb, size_t sz, const char* file, long line) {
+    return calloc_at(nmemb, sz, file, line, UNKNOWN_SITE);
+}
+
 
 /// m61_get_statistics(stats)
 ///    Store the current memory statistics in `*stats`.
 
 void m61_get_statistics(m61_statistics* stats) {
-    stats->nactive = mystats.nactive;
-    stats->active_size = mystats.active_size;
-    stats->ntotal = mystats.ntotal;
-    stats->total_size = mystats.total_size;
-    stats->nfail = mystats.nfail;
-    stats->fail_size = mystats.fail_size;
-    stats->heap_max = mystats.heap_max;
-    stats->heap_min = mystats.heap_min;
+    unsigned long long nfree = 0, free_size = 0;
+    stats->ntotal = stats->total_size = stats->nfail = stats->fail_size = 0;
+
+    // add up the statistics shards of all threads
+    for (struct stats_shard* shard = all_shards.load(); shard; shard = shard->next) {
+      stats->ntotal += shard->ntotal.load(std::memory_order_relaxed);
+      stats->total_size += shard->total_size.load(std::memory_order_relaxed);
+      nfree += shard->nfree.load(std::memory_order_relaxed);
+      free_size += shard->free_size.load(std::memory_order_relaxed);
+      stats->nfail += shard->nfail.load(std::memory_order_relaxed);
+      stats->fail_size += shard->fail_size.load(std::memory_order_relaxed);
+    }
+
+    stats->nactive = stats->ntotal - nfree;
+    stats->active_size = stats->total_size - free_size;
+    stats->heap_max = heap_max.load(std::memory_order_relaxed);
+    stats->heap_min = heap_min.load(std::memory_order_relaxed);
 }
 
 
@@ -263,25 +1761,271 @@ void m61_print_statistics() {
 }
 
 
-/// m61_print_leak_report()
-///    Print a report of all currently-active allocated blocks of dynamic
-///    memory.
+/// m61_get_extra_statistics(stats)
+///    Store the peak and size histogram statistics in `*stats`.
 
-void m61_print_leak_report() {
+void m61_get_extra_statistics(m61_extra_statistics* stats) {
+    stats->peak_active_size = peak_active_size.load(std::memory_order_relaxed);
+    stats->peak_time = peak_time.load(std::memory_order_relaxed);
+    for (int i = 0; i < M61_NSIZE_BUCKETS; i++) {
+      stats->size_histogram[i] = 0;
+    }
+    for (struct stats_shard* shard = all_shards.load(); shard; shard = shard->next) {
+      for (int i = 0; i < M61_NSIZE_BUCKETS; i++) {
+        stats->size_histogram[i] += shard->size_histogram[i].load(std::memory_order_relaxed);
+      }
+    }
+}
+
+
+/// m61_get_site_statistics(sites, n)
+///    Store up to `n` allocation sites with the most active bytes in
+///    `sites`, most first. Returns the number of sites with active pointers.
+
+size_t m61_get_site_statistics(m61_site_statistics* out, size_t n) {
+    std::vector<m61_site_statistics> v;
+    uint32_t count = nsites.load(std::memory_order_acquire);
+    for (uint32_t id = 0; id < count; id++) {
+      unsigned long long nactive = sites[id].nactive.load(std::memory_order_relaxed);
+      if (nactive) {
+        v.push_back({sites[id].file, sites[id].line, nactive,
+                     sites[id].active_size.load(std::memory_order_relaxed)});
+      }
+    }
+    n = std::min(n, v.size());
+    std::partial_sort(v.begin(), v.begin() + n, v.end(),
+                      [] (const m61_site_statistics& a, const m61_site_statistics& b) {
+                        return a.active_size > b.active_size;
+                      });
+    std::copy(v.begin(), v.begin() + n, out);
+    return v.size();
+}
+
+
+/// m61_print_extra_statistics()
+///    Print the peak, the size histogram, and the 10 sites with the most
+///    active bytes.
+
+void m61_print_extra_statistics() {
+    m61_extra_statistics stats;
+    m61_get_extra_statistics(&stats);
+    printf("peak active size: %llu bytes at %.6fs\n",
+           stats.peak_active_size, stats.peak_time / 1e9);
+    for (int i = 0; i < M61_NSIZE_BUCKETS; i++) {
+      if (stats.size_histogram[i]) {
+        unsigned long long lo = i ? 1ULL << (i - 1) : 0;
+        unsigned long long hi = i ? (lo << 1) - 1 : 0;
+        printf("alloc size %10llu-%-10llu %10llu\n", lo, hi, stats.size_histogram[i]);
+      }
+    }
+
+    m61_site_statistics top[10];
+    size_t n = std::min(m61_get_site_statistics(top, 10), (size_t) 10);
+    for (size_t i = 0; i < n; i++) {
+      printf("ACTIVE SITE: %s: %llu bytes in %llu pointers\n",
+             site_name(top[i].file, top[i].line).c_str(), top[i].active_size, top[i].nactive);
+    }
+}
+
+
+// walk_heap(page, block, gap)
+//    Walk the pages of the heap that ever held a block, in address order,
+//    reading only the page map and block headers. Calls `block(blocksz)` for
+//    each active block, `gap(gapsz)` for each free range between two blocks
+//    in a run of such pages, and then `page(addr, live, first)` for the page
+//    at `addr`, where `live` bytes of the page are in blocks and `first` is
+//    true if the page starts a run. Skips leaves of the page map that were
+//    never reserved, so the time is linear in active blocks plus the pages
+//    of the reserved leaves between heap_min and heap_max.
+
+template <typename P, typename B, typename G>
+static void walk_heap(P page, B block, G gap) {
+    const uintptr_t leafsize = PAGEMAP_PAGESIZE << PAGEMAP_LEAF_BITS;
+    uintptr_t a = heap_min.load(std::memory_order_relaxed) & ~(PAGEMAP_PAGESIZE - 1);
+    uintptr_t hi = heap_max.load(std::memory_order_relaxed);
+    uintptr_t end = 0;          // end of the last block in this run, or 0
+    bool inrun = false;
+    std::vector<std::pair<uintptr_t, uintptr_t>> starts;
+    while (a != 0 && a < hi) {
+      struct page_entry* pe = pagemap_entry(a, false);
+      if (!pe || !pe->used.load(std::memory_order_relaxed)) {
+        end = 0;
+        inrun = false;
+        a = pe ? a + PAGEMAP_PAGESIZE : (a & ~(leafsize - 1)) + leafsize;
+        continue;
+      }
+
+      // blocks starting on this page, in address order; skip those being
+      // freed right now
+      starts.clear();
+      {
+        mt_guard guard(pagemap_locks[(a >> PAGEMAP_SHIFT) % NPAGEMAP_LOCKS]);
+        for (struct attributes* b = pe->blocks.load(std::memory_order_relaxed);
+             b; b = b->page_next) {
+          size_t sz = b->sz;
+          if (sz != LARGEST_INT) {
+            starts.push_back({(uintptr_t) b, (uintptr_t) b + block_size(sz)});
+          }
+        }
+      }
+      std::sort(starts.begin(), starts.end());
+
+      uintptr_t pageend = a + PAGEMAP_PAGESIZE;
+      size_t live = end > a ? std::min(end, pageend) - a : 0;
+      for (auto& s : starts) {
+        if (end != 0 && s.first > end) {
+          gap(s.first - end);
+        }
+        block(s.second - s.first);
+        live += std::min(s.second, pageend) - s.first;
+        end = s.second;
+      }
+      page(a, std::min(live, (size_t) PAGEMAP_PAGESIZE), !inrun);
+      inrun = true;
+      a = pageend;
+    }
+}
+
+
+/// m61_get_fragmentation_statistics(stats)
+///    Walk the heap and store its layout in `*stats`.
+
+void m61_get_fragmentation_statistics(m61_fragmentation_statistics* stats) {
+    static_assert(M61_PAGESIZE == PAGEMAP_PAGESIZE, "page size");
+    memset(stats, 0, sizeof(*stats));
+    walk_heap([&] (uintptr_t, size_t live, bool first) {
+                if (first) {
+                  ++stats->nregions;
+                }
+                if (live) {
+                  ++stats->npages;
+                  ++stats->occupancy_histogram[(live - 1) * M61_NOCCUPANCY_BUCKETS / M61_PAGESIZE];
+                } else {
+                  ++stats->nempty_pages;
+                }
+              },
+              [&] (size_t blocksz) {
+                ++stats->nblocks;
+                stats->block_size += blocksz;
+              },
+              [&] (size_t gapsz) {
+                ++stats->ngaps;
+                stats->gap_size += gapsz;
+                stats->largest_gap = std::max(stats->largest_gap, (unsigned long long) gapsz);
+                ++stats->gap_histogram[size_bucket(gapsz)];
+              });
+    if (stats->gap_size) {
+      stats->fragmentation = 1 - (double) stats->largest_gap / stats->gap_size;
+    }
+    unsigned long long needed = (stats->block_size + M61_PAGESIZE - 1) / M61_PAGESIZE;
+    unsigned long long held = stats->npages + stats->nempty_pages;
+    stats->nreleasable_pages = held > needed ? held - needed : 0;
+}
+
+
+// print_heap_map(npages)
+//    Draw the heap, which has about `npages` pages that held blocks, in at
+//    most about HEAP_MAP_CELLS characters, HEAP_MAP_WIDTH to a row. Each run
+//    of pages starts a new row.
+
+const size_t HEAP_MAP_WIDTH = 64;
+const size_t HEAP_MAP_CELLS = 32 * HEAP_MAP_WIDTH;
+
+static void print_heap_map(unsigned long long npages) {
+    static const char levels[] = " .:-=+*#%@";
+    const size_t nlevels = sizeof(levels) - 2;
+    size_t cellpages = std::max((npages + HEAP_MAP_CELLS - 1) / HEAP_MAP_CELLS, 1ULL);
+    printf("HEAP MAP: %zu page%s per character\n", cellpages, cellpages == 1 ? "" : "s");
+
+    std::string row;
+    uintptr_t rowaddr = 0;
+    size_t live = 0, n = 0;     // of the current character
+    auto flush_cell = [&] () {
+      if (n) {
+        // round up, so only a page with no block bytes is blank
+        size_t bytes = n * PAGEMAP_PAGESIZE;
+        row.push_back(levels[(live * nlevels + bytes - 1) / bytes]);
+        live = n = 0;
+      }
+    };
+    auto flush_row = [&] () {
+      flush_cell();
+      if (!row.empty()) {
+        printf("HEAP MAP: %p |%s|\n", (void*) rowaddr, row.c_str());
+        row.clear();
+      }
+    };
+    walk_heap([&] (uintptr_t addr, size_t pagelive, bool first) {
+                if (first || row.size() == HEAP_MAP_WIDTH) {
+                  flush_row();
+                }
+                if (row.empty() && n == 0) {
+                  rowaddr = addr;
+                }
+                live += pagelive;
+                if (++n == cellpages) {
+                  flush_cell();
+                }
+              },
+              [] (size_t) {}, [] (size_t) {});
+    flush_row();
+}
 
-    std::set<void*>::iterator setIt = active_ptr.begin();
 
-    // loop through all pointers currently in the active pointer set
-    for (unsigned long i = 0; i < active_ptr.size(); i++) {
+/// m61_print_fragmentation_report(heatmap)
+///    Print the layout of the heap, and draw it if `heatmap` is true.
+
+void m61_print_fragmentation_report(bool heatmap) {
+    m61_fragmentation_statistics stats;
+    m61_get_fragmentation_statistics(&stats);
+    printf("heap blocks: %llu (%llu bytes) in %llu regions\n",
+           stats.nblocks, stats.block_size, stats.nregions);
+    printf("heap gaps:   %llu (%llu bytes), largest %llu bytes, fragmentation %.3f\n",
+           stats.ngaps, stats.gap_size, stats.largest_gap, stats.fragmentation);
+    for (int i = 0; i < M61_NSIZE_BUCKETS; i++) {
+      if (stats.gap_histogram[i]) {
+        unsigned long long lo = i ? 1ULL << (i - 1) : 0;
+        unsigned long long hi = i ? (lo << 1) - 1 : 0;
+        printf("gap size %10llu-%-10llu %10llu\n", lo, hi, stats.gap_histogram[i]);
+      }
+    }
+    printf("heap pages:  %llu in use, %llu empty, %llu releasable\n",
+           stats.npages, stats.nempty_pages, stats.nreleasable_pages);
+    for (int i = 0; i < M61_NOCCUPANCY_BUCKETS; i++) {
+      if (stats.occupancy_histogram[i]) {
+        printf("page occupancy %5.1f%%-%5.1f%% %10llu\n",
+               i * 100.0 / M61_NOCCUPANCY_BUCKETS, (i + 1) * 100.0 / M61_NOCCUPANCY_BUCKETS,
+               stats.occupancy_histogram[i]);
+      }
+    }
+    if (heatmap) {
+      print_heap_map(stats.npages + stats.nempty_pages);
+    }
+}
+
+/// m61_print_leak_report()
+///    Print a report of all currently-active allocated blocks of dynamic
+///    memory. With M61_SAMPLE set, only sampled blocks are reported, each
+///    with an estimate of the leaked bytes it stands for.
 
-      // print out pointer and its attributes
-      struct attributes info = ptrmap.find((void*) *setIt)->second;
-      const char* file = info.file;
-      long line = info.line;
-      size_t sz = info.sz;
-      printf("LEAK CHECK: %s:%ld: allocated object %p with size %zu\n", file, line, *setIt, sz);
+void m61_print_leak_report() {
 
-      setIt++;
+    // loop through all pointers currently in the active pointer lists
+    for (int i = 0; i < NACTIVE_LISTS; i++) {
+      mt_guard guard(active_lists[i].lock);
+      for (struct attributes* info = active_lists[i].head; info; info = info->next) {
+
+        // print out pointer and its attributes
+        void* ptr = (void*) ((uintptr_t) info + METADATA_SIZE);
+        if (opts.sample_interval) {
+          // a sampled pointer stands for more unsampled ones
+          printf("LEAK CHECK: %s: allocated object %p with size %zu (sampled, ~%zu bytes)\n",
+                 site_name(info->file, info->line).c_str(), ptr, info->sz, (size_t) sample_weight(info->sz));
+        } else {
+          printf("LEAK CHECK: %s: allocated object %p with size %zu\n",
+                 site_name(info->file, info->line).c_str(), ptr, info->sz);
+        }
+      }
     }
 }
 
@@ -291,17 +2035,100 @@ bool greater_than(struct attributes info1, struct attributes info2) {
   return (info1.sz > info2.sz);
 }
 
+// print_summary_heavy_hitters()
+//    Print the heavy hitter report from the Space-Saving summaries of all
+//    threads. Takes O(k) time per thread, so it can be called at any time
+//    while the program runs.
+
+static void print_summary_heavy_hitters() {
+
+  // merge the summaries of all threads. A site missing from a full summary
+  // may still have up to that summary's smallest count there.
+  std::vector<struct hh_counter> merged;
+  std::map<std::pair<const char*, long>, size_t> position;
+  size_t totalsz = 0;
+  for (struct stats_shard* shard = all_shards.load(); shard; shard = shard->next) {
+    mt_guard guard(shard->hhlock);
+    const struct hh_summary* hs = &shard->hhsummary;
+    for (size_t i = 0; i < hs->n; i++) {
+      auto key = std::make_pair(hs->heap[i].file, hs->heap[i].line);
+      if (position.count(key) == 0) {
+        position[key] = merged.size();
+        merged.push_back({ key.first, key.second, 0, 0, 0 });
+      }
+    }
+    totalsz += shard->total_size.load(std::memory_order_relaxed);
+  }
+  for (struct stats_shard* shard = all_shards.load(); shard; shard = shard->next) {
+    mt_guard guard(shard->hhlock);
+    const struct hh_summary* hs = &shard->hhsummary;
+    for (auto it = merged.begin(); it != merged.end(); ++it) {
+      size_t pos = hh_summary_find(hs, it->file, it->line);
+      if (pos != LARGEST_INT) {
+        it->count += hs->heap[pos].count;
+        it->error += hs->heap[pos].error;
+      } else if (hs->n == hs->k) {
+        it->count += hs->heap[0].count;
+        it->error += hs->heap[0].count;
+      }
+    }
+  }
+  std::sort(merged.begin(), merged.end(), [] (const hh_counter& a, const hh_counter& b) {
+    return a.count > b.count;
+  });
+
+  for (auto it = merged.begin(); it != merged.end(); ++it) {
+    double percentage = it->count * 100;
+    percentage /= totalsz;
+    printf("HEAVY HITTER: %s: %zu bytes (~%.1f%%, error <= %zu bytes)\n",
+           site_name(it->file, it->line).c_str(), it->count, percentage, it->error);
+    // stop once a site is not sure to be above the threshold
+    double guaranteed = (it->count - it->error) * 100;
+    guaranteed /= totalsz;
+    if (guaranteed < 10) {
+      break;
+    }
+  }
+}
+
 /// m61_print_heavy_hitter_report()
-///    Print a report of heavily-used allocation locations.
+///    Print a report of heavily-used allocation locations. With M61_HH_K
+///    set, the counts are estimates, and each line says how much the count
+///    might be too high.
 
 void m61_print_heavy_hitter_report() {
 
+  if (opts.hh_k) {
+    print_summary_heavy_hitters();
+    return;
+  }
+
   // A vector containing struct attributes of every allocated pointer.
   std::vector<struct attributes> sortv;
 
   //Counts for total allocated size.
   size_t totalsz = 0;
 
+  // the site table's counts, then those of sites that didn't fit in it
+  uint32_t n = sites ? nsites.load(std::memory_order_acquire) : 0;
+  for (uint32_t i = 0; i != n; ++i) {
+    if (size_t size = sites[i].total_size.load(std::memory_order_relaxed)) {
+      sortv.push_back({ sites[i].file, sites[i].line, size, 0, 0, nullptr, nullptr, nullptr, nullptr });
+      totalsz += size;
+    }
+  }
+
+  // merge the heavy hitter maps of all threads
+  hhmap_type hhmap;
+  for (struct stats_shard* shard = all_shards.load(); shard; shard = shard->next) {
+    mt_guard guard(shard->hhlock);
+    for (auto it = shard->hhmap.cbegin(); it != shard->hhmap.cend(); ++it) {
+      for (auto lit = it->second.cbegin(); lit != it->second.cend(); ++lit) {
+        hhmap[it->first][lit->first] += lit->second;
+      }
+    }
+  }
+
   //retrive file, line and size information from hhmap
   for (auto it = hhmap.cbegin(); it != hhmap.cend(); ++it) {
     const char* file = it->first;
@@ -310,7 +2137,7 @@ void m61_print_heavy_hitter_report() {
     for (auto lit = lineMap.cbegin(); lit != lineMap.cend(); ++lit) {
       long line = lit->first;
       size_t size = lit->second;
-      struct attributes info = { file, line, size }; // initialize attributes struct
+      struct attributes info = { file, line, size, 0, 0, nullptr, nullptr, nullptr, nullptr }; // initialize attributes struct
       sortv.push_back(info);  // insert the struct into sortv
 
       totalsz += size; // increment total allocated size
@@ -322,7 +2149,8 @@ void m61_print_heavy_hitter_report() {
   for (auto it = sortv.begin(); it != sortv.end(); ++it) {
     double percentage = it->sz * 100;
     percentage /= totalsz;
-    printf("HEAVY HITTER: %s:%ld: %zu bytes (~%.1f%%)\n", it->file, it->line, it->sz, percentage);
+    printf("HEAVY HITTER: %s: %zu bytes (~%.1f%%)\n",
+           site_name(it->file, it->line).c_str(), it->sz, percentage);
     if (percentage < 10) {
       break;
     }
@@ -330,30 +2158,193 @@ void m61_print_heavy_hitter_report() {
 }
 
 
-/// m61_realloc(ptr, sz, file, line)
-///    Reallocate the dynamic memory pointed to by `ptr` to hold at least
-///    `sz` bytes, returning a pointer to the new block. If `ptr` is
-///    `nullptr`, behaves like `m61_malloc(sz, file, line)`. If `sz` is 0,
-///    behaves like `m61_free(ptr, file, line)`. The allocation request
-///    was at location `file`:`line`.
+// realloc_at(ptr, sz, file, line, site)
+//    Like m61_realloc, for a caller that may know the id of `file`:`line`
+//    already; see malloc_at.
 
-void* m61_realloc(void* ptr, size_t sz, const char* file, long line) {
+static void* realloc_at(void* ptr, size_t sz, const char* file, long line, uint32_t site) {
 
   if (ptr == nullptr) {
-    return m61_malloc(sz, file, line);
+    return malloc_at(sz, file, line, site);
   }
   if (sz == 0) {
     m61_free(ptr, file, line);
     return 0;
   }
 
-  size_t* metaptr = (size_t*)((uintptr_t)ptr - 16);
+  check_in_heap(ptr, file, line);
+
   size_t oldsz;
-  memcpy((void*)&oldsz, (void*)metaptr, sizeof(size_t));
+  bool in_place = false;
+  if (is_light(ptr)) {
+    uintptr_t* block = (uintptr_t*) ((uintptr_t) ptr - LIGHT_HEADER_SIZE);
+    oldsz = block[0];
+    if (block_capacity(sz) == block_capacity(oldsz)) {
+      block[0] = sz;
+      in_place = true;
+    }
+  } else {
+    struct attributes* metaptr = (struct attributes*)((uintptr_t)ptr - METADATA_SIZE);
+    mt_guard guard(active_list_of(metaptr)->lock);
+    check_active(metaptr, file, line);
+    oldsz = metaptr->sz;
+    if (block_capacity(sz) == block_capacity(oldsz)) {
+      record_site(metaptr->site, oldsz, -1);
+      metaptr->site = site == UNKNOWN_SITE ? site_id(file, line) : site;
+      record_site(metaptr->site, sz, 1);
+      metaptr->file = file;
+      metaptr->line = line;
+      metaptr->sz = sz;
+      memset((char*) ptr + sz, REDZONE_BYTE, TRAILING_REDZONE);   // move the redzone
+      guard.unlock();
+
+      struct stats_shard* shard = get_shard();
+      record_heavy_hitter(shard, metaptr->site, file, line,
+                          opts.sample_interval ? sampled_bytes(shard, sz) : sz);
+      in_place = true;
+    }
+  }
+
+  if (!in_place) {
+    // no room: move to a new block
+    void* newptr = malloc_at(sz, file, line, site);
+    if (newptr) {
+      memcpy(newptr, ptr, std::min(oldsz, sz)); //avoid undefined behavior if (oldsz > sz)
+      m61_free(ptr, file, line);
+    }
+    return newptr;
+  }
+
+  struct stats_shard* shard = get_shard();
+  record_free(shard, oldsz);
+  record_malloc(shard, sz);
+  extend_heap((uintptr_t) ptr, (uintptr_t) ptr + sz);
+  if (opts.trace) {
+    // a resize in place looks like a free and a malloc at the same address
+    trace_record(M61_TRACE_FREE, (uintptr_t) ptr, oldsz, file, line);
+    trace_record(M61_TRACE_MALLOC, (uintptr_t) ptr, sz, file, line);
+  }
+  return ptr;
+}
+
+/// m61_realloc(ptr, sz, file, line)
+///    Reallocate the dynamic memory pointed to by `ptr` to hold at least
+///    `sz` bytes, returning a pointer to the new block. If `ptr` is
+///    `nullptr`, behaves like `m61_malloc(sz, file, line)`. If `sz` is 0,
+///    behaves like `m61_free(ptr, file, line)`. The allocation request
+///    was at location `file`:`line`.
+///
+///    If `sz` has the same capacity as the old size, the block is resized
+///    in place; otherwise the data is copied into a new block and the old
+///    block is freed. Either way the statistics count one free of the old
+///    size and one allocation of the new size. On failure, returns nullptr
+///    and leaves `ptr` alone.
+
+void* m61_realloc(void* ptr, size_t sz, const char* file, long line) {
+    return realloc_at(ptr, sz, file, line, UNKNOWN_SITE);
+}
+
 
-  size_t* newptr = (size_t*) m61_malloc(sz, file, line);
+/// m61_site_id(file, line)
+///    Return the id of the allocation site `file`:`line` for the `_id`
+///    functions below. m61site.hh calls it once per call site.
 
-  memcpy(newptr, ptr, std::min(oldsz, sz)); //avoid undefined behavior if (oldsz > sz)
+uint32_t m61_site_id(const char* file, long line) {
+    load_options_once();
+    return site_id(file, line);
+}
+
+// site_file(site), site_line(site)
+//    Return the file and line of the site with id `site`.
+
+static inline const char* site_file(uint32_t site) {
+    return site < NSITES ? sites[site].file : "?";
+}
+
+static inline long site_line(uint32_t site) {
+    return site < NSITES ? sites[site].line : 0;
+}
+
+/// m61_malloc_id(sz, site), m61_calloc_id(nmemb, sz, site),
+/// m61_realloc_id(ptr, sz, site)
+///    Like m61_malloc, m61_calloc and m61_realloc at the site with id
+///    `site`, which came from m61_site_id. They skip the site lookup.
+
+void* m61_malloc_id(size_t sz, uint32_t site) {
+    return malloc_at(sz, site_file(site), site_line(site), site);
+}
+
+void* m61_calloc_id(size_t nmemb, size_t sz, uint32_t site) {
+    return calloc_at(nmemb, sz, site_file(site), site_line(site), site);
+}
+
+void* m61_realloc_id(void* ptr, size_t sz, uint32_t site) {
+    return realloc_at(ptr, sz, site_file(site), site_line(site), site);
+}
+
+
+/// m61_usable_size(ptr)
+///    Return the number of bytes the active pointer `ptr` may use.
+
+size_t m61_usable_size(void* ptr) {
+    if (is_light(ptr)) {
+      return ((uintptr_t*) ptr)[-2];
+    }
+    struct attributes* metaptr = (struct attributes*)((uintptr_t)ptr - METADATA_SIZE);
+    mt_guard guard(active_list_of(metaptr)->lock);
+    return metaptr->sz;
+}
+
+// Whether m61_lock_all took the locks, and the shards whose locks it took.
+// Shards are only ever added at the head of `all_shards`, so walking from
+// `locked_shards` finds the same ones again.
+static bool locked_all;
+static struct stats_shard* locked_shards;
+
+/// m61_lock_all(), m61_unlock_all()
+///    Take and release every m61 lock. The active lists come first, since
+///    their holders take site_lock and return_address_lock; the rest are
+///    never held while taking another.
+
+void m61_lock_all() {
+    locked_all = opts.threads;
+    if (!locked_all) {
+      return;
+    }
+    for (int i = 0; i < NACTIVE_LISTS; i++) {
+      active_lists[i].lock.lock();
+    }
+    locked_shards = all_shards.load();
+    for (struct stats_shard* shard = locked_shards; shard; shard = shard->next) {
+      shard->hhlock.lock();
+    }
+    site_lock.lock();
+    return_address_lock.lock();
+    for (int i = 0; i < NPAGEMAP_LOCKS; i++) {
+      pagemap_locks[i].lock();
+    }
+    guard_lock.lock();
+    quarantine_lock.lock();
+    base_lock.lock();
+}
 
-  return (void*)newptr;
+void m61_unlock_all() {
+    if (!locked_all) {
+      return;
+    }
+    locked_all = false;
+    base_lock.unlock();
+    quarantine_lock.unlock();
+    guard_lock.unlock();
+    for (int i = 0; i < NPAGEMAP_LOCKS; i++) {
+      pagemap_locks[i].unlock();
+    }
+    return_address_lock.unlock();
+    site_lock.unlock();
+    for (struct stats_shard* shard = locked_shards; shard; shard = shard->next) {
+      shard->hhlock.unlock();
+    }
+    for (int i = 0; i < NACTIVE_LISTS; i++) {
+      active_lists[i].lock.unlock();
+    }
 }
@@ -0,0 +1,389 @@
+#include "m61.hh"
+#include "m61stats.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+#include <cmath>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// m61bench [-w WORKLOAD] [-c CONFIG] [-n NOPS]
+//    Benchmark m61 on standard allocation workloads, under each runtime
+//    configuration, and print the results as a JSON array, one object per
+//    workload and configuration:
+//
+//      ops_per_sec       mallocs, frees and reallocs per second
+//      p50_ns, p99_ns    per-operation latency, from timing every 16th one
+//      peak_rss_kb       growth of the peak resident set during the run
+//      peak_active_bytes m61's peak active size
+//      fragmentation     peak RSS growth divided by peak active bytes: the
+//                        bytes of memory used per byte the program asked
+//                        for, including m61's headers and redzones. When a
+//                        workload holds little memory, m61's own tables
+//                        dominate it.
+//
+//    Each pair runs in its own child process, because m61 reads its options
+//    once per process. -w and -c pick one workload or configuration;
+//    -n sets the number of operations per run (default 1000000).
+
+struct config {
+    const char* name;
+    const char* env[3];         // NAME=VALUE settings, nullptr-terminated
+};
+
+static const config configs[] = {
+    {"default", {nullptr}},
+    {"slab", {"M61_SLAB=1", nullptr}},
+    {"sample", {"M61_SAMPLE=65536", nullptr}},
+    {"slab+sample", {"M61_SLAB=1", "M61_SAMPLE=65536", nullptr}},
+    {"hh_k", {"M61_HH_K=64", nullptr}},
+    {"trace", {"M61_TRACE=", nullptr}},   // file name filled in by run_child
+    {"guard", {"M61_GUARD=4096", nullptr}},
+    {"redzone", {"M61_REDZONE=64", nullptr}},
+    {"poison", {"M61_POISON=1", nullptr}},
+    {"quarantine", {"M61_QUARANTINE=1048576", nullptr}},
+};
+
+
+// Latency samples. Every 16th operation is timed on its own.
+
+static unsigned long long now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct recorder {
+    std::vector<uint32_t> samples;
+    unsigned long long nops = 0;
+
+    template <typename F> auto op(F f) {
+        if (++nops % 16 != 0) {
+            return f();
+        }
+        unsigned long long t0 = now_ns();
+        auto r = f();
+        samples.push_back(std::min<unsigned long long>(now_ns() - t0, UINT32_MAX));
+        return r;
+    }
+    void free_op(void* ptr) {
+        op([&] { free(ptr); return 0; });
+    }
+};
+
+static unsigned xorshift(unsigned& s) {
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    return s;
+}
+
+
+// churn: keep 10000 live blocks of 1 to 512 bytes; each step frees one at
+// random and allocates a replacement.
+
+static void churn(recorder& r, unsigned long long nops) {
+    const int nlive = 10000;
+    std::vector<void*> p(nlive, nullptr);
+    unsigned s = 61;
+    while (r.nops < nops) {
+        unsigned k = xorshift(s) % nlive;
+        r.free_op(p[k]);
+        size_t sz = 1 + xorshift(s) % 512;
+        p[k] = r.op([&] { return malloc(sz); });
+    }
+    for (void* ptr : p) {
+        free(ptr);
+    }
+}
+
+// lifo, fifo: allocate batches of 1000 blocks of 16 to 256 bytes, then free
+// each batch newest first or oldest first.
+
+static void batches(recorder& r, unsigned long long nops, bool lifo) {
+    const int nbatch = 1000;
+    void* p[nbatch];
+    unsigned s = 61;
+    while (r.nops < nops) {
+        for (int i = 0; i != nbatch; ++i) {
+            size_t sz = 16 + xorshift(s) % 241;
+            p[i] = r.op([&] { return malloc(sz); });
+        }
+        for (int i = 0; i != nbatch; ++i) {
+            r.free_op(p[lifo ? nbatch - 1 - i : i]);
+        }
+    }
+}
+
+// realloc: grow 100 buffers from 16 bytes to 64 KiB by about 1.5x per step,
+// round robin, then free them.
+
+static void realloc_growth(recorder& r, unsigned long long nops) {
+    const int nbufs = 100;
+    void* p[nbufs];
+    size_t sz[nbufs];
+    while (r.nops < nops) {
+        for (int i = 0; i != nbufs; ++i) {
+            p[i] = nullptr;
+            sz[i] = 16;
+        }
+        for (bool growing = true; growing; ) {
+            growing = false;
+            for (int i = 0; i != nbufs; ++i) {
+                if (sz[i] <= 65536) {
+                    void* q = r.op([&] { return realloc(p[i], sz[i]); });
+                    memset((char*) q + sz[i] - 8, 0, 8);
+                    p[i] = q;
+                    sz[i] += sz[i] / 2;
+                    growing = true;
+                }
+            }
+        }
+        for (int i = 0; i != nbufs; ++i) {
+            r.free_op(p[i]);
+        }
+    }
+}
+
+// realloc1: grow one buffer a byte at a time up to 64 MiB, then free it
+// and start over. Most calls should resize the buffer in place.
+
+static void realloc_bytewise(recorder& r, unsigned long long nops) {
+    const size_t limit = 64 << 20;
+    while (r.nops < nops) {
+        char* buf = nullptr;
+        for (size_t sz = 1; sz <= limit && r.nops < nops; ++sz) {
+            buf = (char*) r.op([&] { return realloc(buf, sz); });
+            buf[sz - 1] = (char) sz;
+        }
+        r.free_op(buf);
+    }
+}
+
+// hhtest: hhtest's 40 allocation sites and sizes, in phases of skew 0, 1,
+// 2 and -1; each step frees the last block and allocates at a random site
+// picked with the phase's skew.
+
+static void hhtest(recorder& r, unsigned long long nops) {
+    static const size_t sizes[40] = {
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 2, 4, 8, 16, 32, 64,
+        128, 256, 512, 1024, 2048, 4096, 8192, 16384, 20000, 24000
+    };
+    static const double skews[4] = {0, 1, 2, -1};
+    void* ptr = nullptr;
+    unsigned s = 61;
+    for (int phase = 0; phase != 4; ++phase) {
+        double limit[40], sum = 0;
+        for (int i = 0; i != 40; ++i) {
+            sum += pow(0.5, i * skews[phase]);
+            limit[i] = sum;
+        }
+        unsigned long long end = nops * (phase + 1) / 4;
+        while (r.nops < end) {
+            double x = xorshift(s) / 4294967296.0 * sum;
+            int site = 0;
+            while (site < 39 && x > limit[site]) {
+                ++site;
+            }
+            r.free_op(ptr);
+            ptr = r.op([&] { return m61_malloc(sizes[site], "hhtest.cc", 100 + site); });
+        }
+    }
+    free(ptr);
+}
+
+// larson: 4 threads in a ring, each allocating blocks of 16 to 1024 bytes,
+// handing them to the next thread, and freeing the blocks handed to it, so
+// most frees happen on a thread other than the allocating one.
+
+struct mailbox {
+    std::mutex lock;
+    std::vector<void*> ptrs;
+};
+
+static void larson(recorder& r, unsigned long long nops) {
+    const int nthreads = 4;
+    mailbox boxes[nthreads];
+    recorder rs[nthreads];
+    std::thread threads[nthreads];
+    for (int t = 0; t != nthreads; ++t) {
+        threads[t] = std::thread([&, t] {
+            recorder& tr = rs[t];
+            unsigned s = 61 + t;
+            std::vector<void*> batch, mine;
+            while (tr.nops < nops / nthreads) {
+                batch.clear();
+                for (int i = 0; i != 64; ++i) {
+                    size_t sz = 16 + xorshift(s) % 1009;
+                    batch.push_back(tr.op([&] { return malloc(sz); }));
+                }
+                {
+                    std::lock_guard<std::mutex> guard(boxes[(t + 1) % nthreads].lock);
+                    auto& next = boxes[(t + 1) % nthreads].ptrs;
+                    next.insert(next.end(), batch.begin(), batch.end());
+                }
+                {
+                    std::lock_guard<std::mutex> guard(boxes[t].lock);
+                    mine.swap(boxes[t].ptrs);
+                }
+                for (void* ptr : mine) {
+                    tr.free_op(ptr);
+                }
+                mine.clear();
+            }
+        });
+    }
+    for (int t = 0; t != nthreads; ++t) {
+        threads[t].join();
+    }
+    for (int t = 0; t != nthreads; ++t) {
+        for (void* ptr : boxes[t].ptrs) {
+            free(ptr);
+        }
+        r.nops += rs[t].nops;
+        r.samples.insert(r.samples.end(), rs[t].samples.begin(), rs[t].samples.end());
+    }
+}
+
+struct workload {
+    const char* name;
+    void (*run)(recorder&, unsigned long long);
+};
+
+static const workload workloads[] = {
+    {"larson", larson},
+    {"churn", churn},
+    {"lifo", [] (recorder& r, unsigned long long n) { batches(r, n, true); }},
+    {"fifo", [] (recorder& r, unsigned long long n) { batches(r, n, false); }},
+    {"realloc", realloc_growth},
+    {"realloc1", realloc_bytewise},
+    {"hhtest", hhtest},
+};
+
+
+static long peak_rss_kb() {
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+// run(w, c, nops)
+//    Run workload `w` under configuration `c`, whose settings are already
+//    in the environment, and print its JSON object.
+
+static void run(const workload& w, const config& c, unsigned long long nops) {
+    recorder r;
+    r.samples.reserve(nops / 16 + 1024);
+    long rss0 = peak_rss_kb();
+    unsigned long long t0 = now_ns();
+    w.run(r, nops);
+    double seconds = (now_ns() - t0) / 1e9;
+    long rss = peak_rss_kb() - rss0;
+
+    std::sort(r.samples.begin(), r.samples.end());
+    auto percentile = [&] (double p) -> unsigned long long {
+        return r.samples.empty() ? 0 : r.samples[(size_t) (p * (r.samples.size() - 1))];
+    };
+    m61_extra_statistics stats;
+    m61_get_extra_statistics(&stats);
+
+    printf("  {\"workload\": \"%s\", \"config\": \"%s\", \"ops\": %llu, "
+           "\"seconds\": %.4f, \"ops_per_sec\": %.0f, \"p50_ns\": %llu, "
+           "\"p99_ns\": %llu, \"peak_rss_kb\": %ld, \"peak_active_bytes\": %llu, "
+           "\"fragmentation\": %.3f}",
+           w.name, c.name, r.nops, seconds, r.nops / seconds,
+           percentile(0.5), percentile(0.99), rss, stats.peak_active_size,
+           stats.peak_active_size ? rss * 1024.0 / stats.peak_active_size : 0);
+}
+
+// run_child(w, c, nops)
+//    Run workload `w` under configuration `c` in a child process. Returns
+//    false if the child failed.
+
+static bool run_child(const workload& w, const config& c, unsigned long long nops) {
+    fflush(stdout);
+    char trace[64];
+    snprintf(trace, sizeof(trace), "/tmp/m61bench.%d.trace", (int) getpid());
+    pid_t p = fork();
+    if (p == 0) {
+        for (const char* const* e = c.env; *e; ++e) {
+            const char* eq = strchr(*e, '=');
+            std::string name(*e, eq - *e);
+            setenv(name.c_str(), eq[1] ? eq + 1 : trace, 1);
+        }
+        if (strcmp(w.name, "larson") == 0) {
+            setenv("M61_THREADS", "1", 1);
+        }
+        run(w, c, nops);
+        fflush(stdout);
+        _exit(0);
+    }
+    int status;
+    bool ok = p > 0 && waitpid(p, &status, 0) == p
+        && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (!ok) {
+        printf("  {\"workload\": \"%s\", \"config\": \"%s\", \"error\": \"child failed\"}",
+               w.name, c.name);
+    }
+    unlink(trace);
+    return ok;
+}
+
+
+static void usage() {
+    fprintf(stderr, "Usage: m61bench [-w WORKLOAD] [-c CONFIG] [-n NOPS]\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    const char* wname = nullptr;
+    const char* cname = nullptr;
+    unsigned long long nops = 1000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:c:n:")) != -1) {
+        if (opt == 'w') {
+            wname = optarg;
+        } else if (opt == 'c') {
+            cname = optarg;
+        } else if (opt == 'n') {
+            nops = strtoull(optarg, nullptr, 0);
+        } else {
+            usage();
+        }
+    }
+    if (optind != argc || nops == 0) {
+        usage();
+    }
+
+    bool first = true, ok = true, found = false;
+    printf("[\n");
+    for (auto& w : workloads) {
+        for (auto& c : configs) {
+            if ((wname && strcmp(wname, w.name) != 0)
+                || (cname && strcmp(cname, c.name) != 0)) {
+                continue;
+            }
+            if (!first) {
+                printf(",\n");
+            }
+            first = false;
+            found = true;
+            ok = run_child(w, c, nops) && ok;
+        }
+    }
+    printf("\n]\n");
+    if (!found) {
+        fprintf(stderr, "m61bench: no such workload or configuration\n");
+    }
+    return ok && found ? 0 : 1;
+}
@@ -0,0 +1,412 @@
+#define M61_DISABLE 1
+#include "m61.hh"
+#include "m61stats.hh"
+#include "m61preload.hh"
+#include <cstring>
+#include <cstddef>
+#include <cerrno>
+#include <new>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <dlfcn.h>
+
+// m61preload.so: m61 as a drop-in replacement for malloc. Build it as a
+// shared library,
+//    c++ -std=gnu++17 -O2 -fPIC -shared m61preload.cc m61.cc basealloc.cc -o m61preload.so
+// and run an unmodified program under it:
+//    LD_PRELOAD=./m61preload.so PROGRAM
+//
+// Every allocation is attributed to the return address of its malloc call
+// (see `m61_return_address`). Reports look the addresses up as they print
+// them. Set M61_REPORT=1 to print the statistics, the heavy hitters and the
+// sites with the most active bytes to stderr at exit, or M61_REPORT=2 to
+// also print the leak report. The other M61_ options work as usual, and
+// M61_THREADS is on unless set to 0.
+//
+// m61 itself allocates memory with malloc, through the base allocator and
+// its containers. Those calls, and any other call made while m61 is
+// running, go straight to glibc's __libc_ functions, so there is no
+// recursion and, except in malloc_usable_size, no need for dlsym, which
+// itself allocates.
+
+extern "C" {
+void* __libc_malloc(size_t sz);
+void __libc_free(void* ptr);
+void* __libc_calloc(size_t nmemb, size_t sz);
+void* __libc_realloc(void* ptr, size_t sz);
+void* __libc_memalign(size_t align, size_t sz);
+void* __libc_pvalloc(size_t sz);
+}
+
+// Nonzero while this thread is inside m61. Initial-exec TLS needs no
+// allocation to reach, unlike __tls_get_addr.
+static thread_local int depth __attribute__((tls_model("initial-exec")));
+
+// Set once the exit report has run. The base allocator's atexit handler
+// and other late cleanup free memory after it; those frees are ignored.
+static bool exiting;
+
+// A copy of stderr for the exit report, made at startup: programs may close
+// stdout and stderr in their own atexit handlers, which run before ours.
+static int report_fd = -1;
+
+struct m61_call {
+    m61_call() {
+        ++depth;
+    }
+    ~m61_call() {
+        --depth;
+    }
+};
+
+static void preload_exit() {
+    m61_call call;
+    const char* s = getenv("M61_REPORT");
+    int report = s ? atoi(s) : 0;
+    FILE* f = report_fd >= 0 ? fdopen(report_fd, "w") : nullptr;
+    if (!f) {
+        exiting = true;
+        return;
+    }
+    // the report functions print to stdout
+    FILE* out = stdout;
+    stdout = f;
+    if (report >= 1) {
+        m61_print_statistics();
+        m61_print_heavy_hitter_report();
+        m61_print_extra_statistics();
+    }
+    if (report >= 2) {
+        m61_print_leak_report();
+    }
+    stdout = out;
+    fclose(f);
+    exiting = true;
+}
+
+// Hold every m61 lock across fork, so none is left locked in the child by
+// a thread that didn't make it there. Allocations made by other fork
+// handlers in between go to glibc.
+static void preload_fork_prepare() {
+    ++depth;
+    m61_lock_all();
+}
+
+static void preload_fork_release() {
+    m61_unlock_all();
+    --depth;
+}
+
+// preload_init()
+//    Set up the first time an allocation function is called, while only
+//    one thread is running. Must be called inside an `m61_call`.
+static void preload_init() {
+    static bool initialized;
+    if (!initialized) {
+        initialized = true;
+        m61_default_threads = true;
+        if (getenv("M61_REPORT")) {
+            report_fd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 10);
+        }
+        // Make the base allocator install its atexit handler now, so that
+        // ours, installed after it, runs before it.
+        base_free(base_malloc(1));
+        atexit(preload_exit);
+        pthread_atfork(preload_fork_prepare, preload_fork_release,
+                       preload_fork_release);
+    }
+}
+
+__attribute__((constructor)) static void preload_constructor() {
+    m61_call call;
+    preload_init();
+}
+
+
+// Pointers with more alignment than m61 gives are carved out of a bigger
+// block. The three words before such a pointer hold its size, the block,
+// and a tag: the pointer XOR ALIGNED_MAGIC. The tag is a non-canonical
+// address, so the last word of an m61 header never matches it.
+
+static const uintptr_t ALIGNED_MAGIC = 0xA11C4ED000000000UL;
+
+static void* aligned_malloc(size_t align, size_t sz, long site) {
+    if (align <= alignof(std::max_align_t)) {
+        return m61_malloc(sz, m61_return_address, site);
+    }
+    if (sz > SIZE_MAX - align - 32) {
+        return nullptr;
+    }
+    char* block = (char*) m61_malloc(sz + align + 32, m61_return_address, site);
+    if (!block) {
+        return nullptr;
+    }
+    uintptr_t* p = (uintptr_t*) (((uintptr_t) block + 32 + align - 1) & ~(uintptr_t) (align - 1));
+    p[-3] = sz;
+    p[-2] = (uintptr_t) block;
+    p[-1] = (uintptr_t) p ^ ALIGNED_MAGIC;
+    return p;
+}
+
+// aligned_header(ptr)
+//    Return the words before `ptr` if it came from aligned_malloc's
+//    slow path, nullptr otherwise.
+static uintptr_t* aligned_header(void* ptr) {
+    uintptr_t* p = (uintptr_t*) ptr;
+    if (p && p[-1] == ((uintptr_t) p ^ ALIGNED_MAGIC)) {
+        return p - 3;
+    }
+    return nullptr;
+}
+
+static void m61_free_any(void* ptr, long site) {
+    if (uintptr_t* h = aligned_header(ptr)) {
+        ptr = (void*) h[1];
+    }
+    m61_free(ptr, m61_return_address, site);
+}
+
+static void* m61_realloc_any(void* ptr, size_t sz, long site) {
+    uintptr_t* h = aligned_header(ptr);
+    if (!h) {
+        return m61_realloc(ptr, sz, m61_return_address, site);
+    }
+    // realloc need not keep the extra alignment
+    void* newptr = m61_malloc(sz, m61_return_address, site);
+    if (newptr) {
+        memcpy(newptr, ptr, sz < h[0] ? sz : h[0]);
+        m61_free((void*) h[1], m61_return_address, site);
+    }
+    return newptr;
+}
+
+
+// The interposed functions. Each one takes its own return address as the
+// site, so the address is that of the caller's call instruction.
+
+#define RETURN_ADDRESS ((long) __builtin_extract_return_addr(__builtin_return_address(0)))
+
+extern "C" {
+
+void* malloc(size_t sz) {
+    if (depth) {
+        return __libc_malloc(sz);
+    }
+    m61_call call;
+    preload_init();
+    return m61_malloc(sz, m61_return_address, RETURN_ADDRESS);
+}
+
+void free(void* ptr) {
+    if (depth) {
+        __libc_free(ptr);
+        return;
+    }
+    if (!ptr || exiting) {
+        return;
+    }
+    m61_call call;
+    m61_free_any(ptr, RETURN_ADDRESS);
+}
+
+void* calloc(size_t nmemb, size_t sz) {
+    if (depth) {
+        return __libc_calloc(nmemb, sz);
+    }
+    m61_call call;
+    preload_init();
+    return m61_calloc(nmemb, sz, m61_return_address, RETURN_ADDRESS);
+}
+
+void* realloc(void* ptr, size_t sz) {
+    if (depth) {
+        return __libc_realloc(ptr, sz);
+    }
+    m61_call call;
+    preload_init();
+    return m61_realloc_any(ptr, sz, RETURN_ADDRESS);
+}
+
+int posix_memalign(void** memptr, size_t align, size_t sz) {
+    if (align % sizeof(void*) != 0 || (align & (align - 1)) != 0 || align == 0) {
+        return EINVAL;
+    }
+    void* ptr;
+    if (depth) {
+        ptr = __libc_memalign(align, sz);
+    } else {
+        m61_call call;
+        preload_init();
+        ptr = aligned_malloc(align, sz, RETURN_ADDRESS);
+    }
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void* aligned_alloc(size_t align, size_t sz) {
+    if (depth) {
+        return __libc_memalign(align, sz);
+    }
+    if ((align & (align - 1)) != 0 || align == 0) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    m61_call call;
+    preload_init();
+    return aligned_malloc(align, sz, RETURN_ADDRESS);
+}
+
+void* memalign(size_t align, size_t sz) {
+    if (depth) {
+        return __libc_memalign(align, sz);
+    }
+    if ((align & (align - 1)) != 0 || align == 0) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    m61_call call;
+    preload_init();
+    return aligned_malloc(align, sz, RETURN_ADDRESS);
+}
+
+void* valloc(size_t sz) {
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    if (depth) {
+        return __libc_memalign(pagesize, sz);
+    }
+    m61_call call;
+    preload_init();
+    return aligned_malloc(pagesize, sz, RETURN_ADDRESS);
+}
+
+void* pvalloc(size_t sz) {
+    if (depth) {
+        return __libc_pvalloc(sz);
+    }
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    if (sz > SIZE_MAX - pagesize) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    sz = sz ? (sz + pagesize - 1) & ~(pagesize - 1) : pagesize;
+    m61_call call;
+    preload_init();
+    return aligned_malloc(pagesize, sz, RETURN_ADDRESS);
+}
+
+// glibc's malloc_usable_size would read a chunk header that m61 pointers
+// don't have. glibc exports no __libc_ version of it, so the pointers it
+// allocated for m61 are looked up through dlsym, which is safe here: its
+// own allocations go to glibc too.
+size_t malloc_usable_size(void* ptr) {
+    if (!ptr) {
+        return 0;
+    }
+    if (depth) {
+        static size_t (*libc_usable_size)(void*);
+        if (!libc_usable_size) {
+            libc_usable_size = (size_t (*)(void*)) dlsym(RTLD_NEXT, "malloc_usable_size");
+        }
+        return libc_usable_size ? libc_usable_size(ptr) : 0;
+    }
+    m61_call call;
+    if (uintptr_t* h = aligned_header(ptr)) {
+        return h[0];
+    }
+    return m61_usable_size(ptr);
+}
+
+}
+
+
+// operator new and delete call malloc and free from inside libstdc++, which
+// would give every C++ allocation the same site. These versions record the
+// caller instead.
+
+void* operator new(size_t sz) {
+    void* ptr;
+    if (depth) {
+        ptr = __libc_malloc(sz);
+    } else {
+        m61_call call;
+        preload_init();
+        ptr = m61_malloc(sz, m61_return_address, RETURN_ADDRESS);
+    }
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t sz) {
+    void* ptr;
+    if (depth) {
+        ptr = __libc_malloc(sz);
+    } else {
+        m61_call call;
+        preload_init();
+        ptr = m61_malloc(sz, m61_return_address, RETURN_ADDRESS);
+    }
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new(size_t sz, const std::nothrow_t&) noexcept {
+    if (depth) {
+        return __libc_malloc(sz);
+    }
+    m61_call call;
+    preload_init();
+    return m61_malloc(sz, m61_return_address, RETURN_ADDRESS);
+}
+
+void* operator new[](size_t sz, const std::nothrow_t&) noexcept {
+    if (depth) {
+        return __libc_malloc(sz);
+    }
+    m61_call call;
+    preload_init();
+    return m61_malloc(sz, m61_return_address, RETURN_ADDRESS);
+}
+
+void operator delete(void* ptr) noexcept {
+    if (depth) {
+        __libc_free(ptr);
+    } else if (ptr && !exiting) {
+        m61_call call;
+        m61_free_any(ptr, RETURN_ADDRESS);
+    }
+}
+
+void operator delete[](void* ptr) noexcept {
+    if (depth) {
+        __libc_free(ptr);
+    } else if (ptr && !exiting) {
+        m61_call call;
+        m61_free_any(ptr, RETURN_ADDRESS);
+    }
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    if (depth) {
+        __libc_free(ptr);
+    } else if (ptr && !exiting) {
+        m61_call call;
+        m61_free_any(ptr, RETURN_ADDRESS);
+    }
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    if (depth) {
+        __libc_free(ptr);
+    } else if (ptr && !exiting) {
+        m61_call call;
+        m61_free_any(ptr, RETURN_ADDRESS);
+    }
+}
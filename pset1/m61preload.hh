@@ -0,0 +1,28 @@
+#ifndef M61PRELOAD_HH
+#define M61PRELOAD_HH
+#include <cstddef>
+
+// The parts of m61 that only m61preload.cc (see there) uses.
+
+// With LD_PRELOAD=m61preload.so, allocations have no file and line. They
+// are recorded with `file == m61_return_address` and the caller's return
+// address as `line`, and reports print them as `object(symbol+0xoffset)`.
+extern const char m61_return_address[];
+
+// M61_THREADS when it is not set in the environment. The interposer turns
+// it on, since it can't know whether the program has threads.
+extern bool m61_default_threads;
+
+/// m61_usable_size(ptr)
+///    Return the number of bytes the active pointer `ptr` may use: the size
+///    it was allocated with, since the bytes past it are a redzone.
+size_t m61_usable_size(void* ptr);
+
+/// m61_lock_all(), m61_unlock_all()
+///    Take and release every m61 lock, in an order that can't deadlock with
+///    m61's own nesting. The interposer calls them around fork, so the child
+///    never starts with a lock held by a thread it doesn't have.
+void m61_lock_all();
+void m61_unlock_all();
+
+#endif
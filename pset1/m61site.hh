@@ -0,0 +1,34 @@
+#ifndef M61SITE_HH
+#define M61SITE_HH
+#include "m61.hh"
+#include <cstdint>
+
+// Include this after m61.hh to give every allocation call site a small id.
+// Each `malloc`, `calloc` and `realloc` call site registers its `__FILE__`
+// and `__LINE__` once, in a function-local static, and from then on passes
+// only the id, so m61 skips looking the site up and counts the site's
+// heavy hitter bytes with a single add.
+
+uint32_t m61_site_id(const char* file, long line);
+void* m61_malloc_id(size_t sz, uint32_t site);
+void* m61_calloc_id(size_t nmemb, size_t sz, uint32_t site);
+void* m61_realloc_id(void* ptr, size_t sz, uint32_t site);
+
+// M61_SITE_ID()
+//    The id of the call site this expands at.
+#define M61_SITE_ID()                                                       \
+    ([] {                                                                   \
+        static const uint32_t m61_site = m61_site_id(__FILE__, __LINE__);   \
+        return m61_site;                                                    \
+    }())
+
+#if !M61_DISABLE
+#undef malloc
+#undef calloc
+#undef realloc
+#define malloc(sz)          m61_malloc_id((sz), M61_SITE_ID())
+#define calloc(nmemb, sz)   m61_calloc_id((nmemb), (sz), M61_SITE_ID())
+#define realloc(ptr, sz)    m61_realloc_id((ptr), (sz), M61_SITE_ID())
+#endif
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef M61STATS_HH
+#define M61STATS_HH
+#include <cstddef>
+
+// Statistics that m61 keeps besides `m61_statistics`. The extra and site
+// statistics are updated in O(1) time per allocation and free.
+
+#define M61_NSIZE_BUCKETS 65
+
+struct m61_extra_statistics {
+    unsigned long long peak_active_size;    // most bytes ever active at once
+    unsigned long long peak_time;           // when, in ns since m61 started
+    unsigned long long size_histogram[M61_NSIZE_BUCKETS];
+        // number of allocations by size: bucket 0 counts allocations of 0
+        // bytes, and bucket i counts sizes in [2^(i-1), 2^i)
+};
+
+struct m61_site_statistics {
+    const char* file;
+    long line;
+    unsigned long long nactive;             // # active pointers allocated here
+    unsigned long long active_size;         // their size in bytes
+};
+
+/// m61_get_extra_statistics(stats)
+///    Store the peak and size histogram statistics in `*stats`.
+void m61_get_extra_statistics(m61_extra_statistics* stats);
+
+/// m61_get_site_statistics(sites, n)
+///    Store the allocation sites with the most active bytes in `sites`, up
+///    to `n` of them, most active bytes first. Returns the number of sites
+///    with active pointers. With M61_SAMPLE, only counts sampled pointers.
+size_t m61_get_site_statistics(m61_site_statistics* sites, size_t n);
+
+/// m61_print_extra_statistics()
+///    Print the peak, the size histogram, and the 10 sites with the most
+///    active bytes.
+void m61_print_extra_statistics();
+
+
+// The layout of the heap, computed on demand by walking the page map, which
+// indexes every active pointer. The walk reads block headers but never the
+// data, and takes time linear in the active pointers plus the indexed pages.
+// Blocks include their metadata and redzones. With M61_SAMPLE, unsampled
+// pointers are not indexed and count as free space.
+
+#define M61_PAGESIZE 4096
+#define M61_NOCCUPANCY_BUCKETS 8
+
+struct m61_fragmentation_statistics {
+    unsigned long long nblocks;             // # active blocks
+    unsigned long long block_size;          // their size in bytes
+    unsigned long long nregions;            // # runs of pages that held blocks
+    unsigned long long ngaps;               // # free ranges between blocks
+    unsigned long long gap_size;            // their size in bytes
+    unsigned long long largest_gap;         // the size of the largest one
+    double fragmentation;                   // 1 - largest_gap / gap_size
+    unsigned long long gap_histogram[M61_NSIZE_BUCKETS];
+        // number of gaps by size, bucketed like `size_histogram`
+    unsigned long long npages;              // # pages holding block bytes
+    unsigned long long nempty_pages;        // # pages that held blocks, but
+                                            // hold none now
+    unsigned long long nreleasable_pages;   // # pages, of those two kinds,
+                                            // left empty if the blocks were
+                                            // packed together
+    unsigned long long occupancy_histogram[M61_NOCCUPANCY_BUCKETS];
+        // number of pages by block bytes: bucket i counts pages with more
+        // than i/8 and at most (i+1)/8 of their bytes in blocks
+};
+
+/// m61_get_fragmentation_statistics(stats)
+///    Walk the heap and store its layout in `*stats`.
+void m61_get_fragmentation_statistics(m61_fragmentation_statistics* stats);
+
+/// m61_print_fragmentation_report(heatmap)
+///    Print the layout of the heap. If `heatmap` is true, also draw each
+///    run of pages as rows of characters, from ' ' (no block bytes) to '@'
+///    (full), one character per page or per group of pages.
+void m61_print_fragmentation_report(bool heatmap);
+
+#endif
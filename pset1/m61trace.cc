@@ -0,0 +1,214 @@
+#include "m61trace.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+#include <vector>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// m61trace [-l] [-h] [-c NPOINTS] FILE
+//    Read the trace that a program run with M61_TRACE=FILE left behind and
+//    rebuild m61's reports from it:
+//      -l          the leak report, in the format of m61_print_leak_report
+//      -h          the heavy hitter report, like m61_print_heavy_hitter_report
+//      -c NPOINTS  the live bytes curve: NPOINTS lines of time and the most
+//                  bytes live during that stretch of time, then the peak
+//    With no options, prints all three.
+//
+//    If the ring buffer wrapped, only the newest records are left. Frees of
+//    pointers allocated before them are ignored by the leak report, and the
+//    curve counts live bytes from the first record left.
+
+struct trace {
+    const struct m61_trace_header* header;
+    const struct m61_trace_site* sites;
+    const struct m61_trace_record* records;
+    uint64_t first;                 // number of the oldest record left
+    uint64_t last;                  // one past the newest record
+};
+
+static const struct m61_trace_record& record(const trace& t, uint64_t i) {
+    return t.records[i % t.header->capacity];
+}
+
+// site_name(t, site)
+//    Return the `file:line` name of `site`.
+
+static std::string site_name(const trace& t, uint32_t site) {
+    if (site >= t.header->nsites) {
+        return "?:0";
+    }
+    return std::string(t.sites[site].file) + ":" + std::to_string(t.sites[site].line);
+}
+
+
+static void print_leak_report(const trace& t) {
+    // the record of each active pointer
+    std::unordered_map<uint64_t, uint64_t> active;
+    for (uint64_t i = t.first; i != t.last; ++i) {
+        const m61_trace_record& r = record(t, i);
+        if (r.op == M61_TRACE_MALLOC) {
+            active[r.ptr] = i;
+        } else if (r.op == M61_TRACE_FREE) {
+            active.erase(r.ptr);
+        }
+    }
+
+    std::vector<uint64_t> leaks;
+    for (auto& it : active) {
+        leaks.push_back(it.second);
+    }
+    std::sort(leaks.begin(), leaks.end());
+    for (uint64_t i : leaks) {
+        const m61_trace_record& r = record(t, i);
+        printf("LEAK CHECK: %s: allocated object %p with size %" PRIu64 "\n",
+               site_name(t, r.site).c_str(), (void*) r.ptr, r.size);
+    }
+}
+
+
+static void print_heavy_hitter_report(const trace& t) {
+    // Sites with the same name count together, even if their file name
+    // strings had different addresses in the program.
+    std::map<std::string, uint64_t> bytes;
+    uint64_t total = 0;
+    for (uint64_t i = t.first; i != t.last; ++i) {
+        const m61_trace_record& r = record(t, i);
+        if (r.op == M61_TRACE_MALLOC) {
+            bytes[site_name(t, r.site)] += r.size;
+            total += r.size;
+        }
+    }
+
+    std::vector<std::pair<uint64_t, std::string>> sorted;
+    for (auto& it : bytes) {
+        sorted.push_back({it.second, it.first});
+    }
+    std::sort(sorted.begin(), sorted.end(), [] (auto& a, auto& b) {
+        return a.first > b.first;
+    });
+    for (auto& it : sorted) {
+        double percentage = it.first * 100.0 / total;
+        printf("HEAVY HITTER: %s: %" PRIu64 " bytes (~%.1f%%)\n",
+               it.second.c_str(), it.first, percentage);
+        if (percentage < 10) {
+            break;
+        }
+    }
+}
+
+
+static void print_curve(const trace& t, int npoints) {
+    if (t.first == t.last) {
+        return;
+    }
+    uint64_t t0 = record(t, t.first).time;
+    uint64_t t1 = record(t, t.last - 1).time;
+    uint64_t width = (t1 - t0) / npoints + 1;
+
+    // Records from different threads can be slightly out of time order,
+    // so clamp each one into the current point.
+    long long live = 0, peak = 0, point_max = 0;
+    uint64_t peak_time = t0;
+    int point = 0;
+    for (uint64_t i = t.first; i != t.last; ++i) {
+        const m61_trace_record& r = record(t, i);
+        int p = std::min<uint64_t>(std::max(r.time, t0) - t0, t1 - t0) / width;
+        for (; point < p; ++point) {
+            printf("CURVE: %.6fs %lld\n", (t0 + (point + 1) * width) / 1e9, point_max);
+            point_max = live;
+        }
+        if (r.op == M61_TRACE_MALLOC) {
+            live += r.size;
+        } else if (r.op == M61_TRACE_FREE) {
+            live -= r.size;
+        }
+        point_max = std::max(point_max, live);
+        if (live > peak) {
+            peak = live;
+            peak_time = r.time;
+        }
+    }
+    printf("CURVE: %.6fs %lld\n", (t0 + (point + 1) * width) / 1e9, point_max);
+    printf("PEAK: %lld bytes at %.6fs\n", peak, peak_time / 1e9);
+}
+
+
+static void usage() {
+    fprintf(stderr, "Usage: m61trace [-l] [-h] [-c NPOINTS] FILE\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    bool leaks = false, heavy = false;
+    int npoints = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "lhc:")) != -1) {
+        if (opt == 'l') {
+            leaks = true;
+        } else if (opt == 'h') {
+            heavy = true;
+        } else if (opt == 'c') {
+            npoints = strtol(optarg, nullptr, 0);
+            if (npoints <= 0) {
+                usage();
+            }
+        } else {
+            usage();
+        }
+    }
+    if (optind + 1 != argc) {
+        usage();
+    }
+    if (!leaks && !heavy && !npoints) {
+        leaks = heavy = true;
+        npoints = 50;
+    }
+
+    // map the trace
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat s;
+    if (fd < 0 || fstat(fd, &s) != 0) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    size_t minsz = M61_TRACE_HEADER_SIZE + M61_TRACE_NSITES * sizeof(m61_trace_site);
+    void* m = MAP_FAILED;
+    if ((size_t) s.st_size >= minsz) {
+        m = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    trace t;
+    t.header = (const m61_trace_header*) m;
+    if (m == MAP_FAILED
+        || t.header->magic != M61_TRACE_MAGIC
+        || t.header->capacity == 0
+        || t.header->capacity > (s.st_size - minsz) / sizeof(m61_trace_record)) {
+        fprintf(stderr, "%s: not an m61 trace\n", argv[optind]);
+        exit(1);
+    }
+    t.sites = (const m61_trace_site*) ((const char*) m + M61_TRACE_HEADER_SIZE);
+    t.records = (const m61_trace_record*) (t.sites + M61_TRACE_NSITES);
+    t.last = t.header->nrecords;
+    t.first = t.last > t.header->capacity ? t.last - t.header->capacity : 0;
+    if (t.first != 0) {
+        fprintf(stderr, "m61trace: ring buffer wrapped, only the last %" PRIu64
+                " of %" PRIu64 " records are left\n", t.header->capacity, t.last);
+    }
+
+    if (leaks) {
+        print_leak_report(t);
+    }
+    if (heavy) {
+        print_heavy_hitter_report(t);
+    }
+    if (npoints) {
+        print_curve(t, npoints);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef M61TRACE_HH
+#define M61TRACE_HH
+#include <cstdint>
+#include <atomic>
+
+// Layout of an m61 trace file. With M61_TRACE=FILE set, m61 maps FILE and
+// appends one record per operation to a ring buffer in it; m61trace reads
+// it back. The file holds, in order:
+//
+//    struct m61_trace_header                  (M61_TRACE_HEADER_SIZE bytes)
+//    struct m61_trace_site[M61_TRACE_NSITES]  (allocation sites)
+//    struct m61_trace_record[capacity]        (the ring buffer)
+//
+// Record `i` is stored at `i % capacity`, so once `nrecords > capacity`
+// only the newest `capacity` records are left.
+
+#define M61_TRACE_MAGIC 0x454341525431364DULL   // "M61TRACE" on little-endian
+#define M61_TRACE_HEADER_SIZE 4096
+#define M61_TRACE_NSITES 65536
+#define M61_TRACE_NOSITE 0xFFFFFFFFU             // site table was full
+#define M61_TRACE_FILESZ 52                      // longer names are cut
+
+enum m61_trace_op : uint32_t {
+    M61_TRACE_MALLOC = 1,       // ptr, size: a new pointer
+    M61_TRACE_FREE = 2,         // ptr, size: a freed pointer and its size
+    M61_TRACE_FAIL = 3,         // size: a failed allocation
+};
+
+struct m61_trace_header {
+    uint64_t magic;                         // M61_TRACE_MAGIC
+    uint64_t capacity;                      // number of records in the ring
+    std::atomic<uint64_t> nrecords;         // number of records ever written
+    std::atomic<uint32_t> nsites;           // number of sites in the table
+    uint32_t pad;
+    uint64_t start_time;                    // CLOCK_MONOTONIC ns at start
+};
+
+struct m61_trace_site {
+    int64_t line;
+    char file[M61_TRACE_FILESZ];            // null-terminated
+    uint32_t pad;
+};
+
+struct m61_trace_record {
+    uint32_t op;                            // an m61_trace_op
+    uint32_t site;                          // index into the site table
+    uint64_t ptr;
+    uint64_t size;
+    uint64_t time;                          // ns since `start_time`
+};
+
+static_assert(sizeof(m61_trace_header) <= M61_TRACE_HEADER_SIZE, "header too big");
+static_assert(sizeof(m61_trace_site) == 64, "site size");
+static_assert(sizeof(m61_trace_record) == 32, "record size");
+
+#endif
@@ -0,0 +1,29 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Statistics and leak report with the slab backend (M61_SLAB=1).
+
+int main() {
+    setenv("M61_SLAB", "1", 1);
+    void* ptrs[10];
+    for (int i = 0; i != 10; ++i) {
+        ptrs[i] = malloc(i + 1);
+    }
+    for (int i = 0; i != 5; ++i) {
+        free(ptrs[i]);
+    }
+    void* big = malloc(3000);
+    free(big);
+    m61_print_statistics();
+    m61_print_leak_report();
+}
+
+//!!UNORDERED
+//! alloc count: active          5   total         11   fail          0
+//! alloc size:  active         40   total       3055   fail          0
+//! LEAK CHECK: test???.cc:11: allocated object ??{\w+}?? with size 6
+//! LEAK CHECK: test???.cc:11: allocated object ??{\w+}?? with size 7
+//! LEAK CHECK: test???.cc:11: allocated object ??{\w+}?? with size 8
+//! LEAK CHECK: test???.cc:11: allocated object ??{\w+}?? with size 9
+//! LEAK CHECK: test???.cc:11: allocated object ??{\w+}?? with size 10
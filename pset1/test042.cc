@@ -0,0 +1,21 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Double free with the slab backend: freed blocks are not reused too soon.
+
+int main() {
+    setenv("M61_SLAB", "1", 1);
+    char* ptrs[100];
+    for (int i = 0; i != 100; ++i) {
+        ptrs[i] = (char*) malloc(24);
+        free(ptrs[i]);
+    }
+    fprintf(stderr, "Will free %p\n", ptrs[50]);
+    free(ptrs[50]);
+    m61_print_statistics();
+}
+
+//! Will free ??{0x\w+}=ptr??
+//! MEMORY BUG???: invalid free of pointer ??ptr??, double free
+//! ???
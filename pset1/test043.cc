@@ -0,0 +1,65 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <atomic>
+#include <thread>
+// Exercise many allocation sites from several threads at once
+// (M61_THREADS=1). Like `test013.cc`, but some pointers are freed
+// by a different thread than the one that allocated them.
+
+const char* files[8] = {
+    "unprovoked.cc", "perissodactylate.cc", "makhzan.cc", "Janthinidae.cc",
+    "allothigenetic.cc", "taller.cc", "salmis.cc", "fortuity.cc"
+};
+
+const int nthreads = 4;
+const int nshared = 64;
+std::atomic<void*> shared[nshared];
+
+static void worker(unsigned seed) {
+    const int nptrs = 200;
+    void* ptrs[nptrs];
+    for (int i = 0; i != nptrs; ++i) {
+        ptrs[i] = nullptr;
+    }
+
+    for (unsigned i = 0; i != 500000 / nthreads; ++i) {
+        const char* file = files[rand_r(&seed) % 8];
+        int line = 1 + rand_r(&seed) % 200;
+        void* ptr = m61_malloc(1 + rand_r(&seed) % 128, file, line);
+
+        if (rand_r(&seed) % 8 == 0) {
+            // hand the pointer to whichever thread comes along next
+            ptr = shared[rand_r(&seed) % nshared].exchange(ptr);
+        }
+        int slot = rand_r(&seed) % nptrs;
+        m61_free(ptrs[slot], file, line + 3);
+        ptrs[slot] = ptr;
+    }
+
+    for (int i = 0; i != nptrs; ++i) {
+        free(ptrs[i]);
+    }
+}
+
+int main() {
+    setenv("M61_THREADS", "1", 1);
+    std::thread threads[nthreads];
+    for (int i = 0; i != nthreads; ++i) {
+        threads[i] = std::thread(worker, 61 + i);
+    }
+    for (int i = 0; i != nthreads; ++i) {
+        threads[i].join();
+    }
+    for (int i = 0; i != nshared; ++i) {
+        free(shared[i].load());
+    }
+
+    m61_print_statistics();
+    m61_print_leak_report();
+}
+
+//!!TIME
+//! alloc count: active          0   total     500000   fail          0
+//! alloc size:  active          0   total        ???   fail          0
@@ -0,0 +1,24 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Streaming heavy hitter report (M61_HH_K) with many more allocation
+// sites than counters.
+
+int main() {
+    setenv("M61_HH_K", "16", 1);
+    for (int i = 0; i != 100000; ++i) {
+        free(m61_malloc(1 + i % 7, "noise.cc", 1000 + i % 5000));
+        if (i % 4 == 0) {
+            free(m61_malloc(40, "heavy.cc", 1));
+        }
+        if (i % 8 == 0) {
+            free(m61_malloc(40, "heavy.cc", 2));
+        }
+    }
+    m61_print_heavy_hitter_report();
+}
+
+//! HEAVY HITTER: heavy.cc:1: ??{\d+}?? bytes (~???%, error <= ??{\d+}?? bytes)
+//! HEAVY HITTER: heavy.cc:2: ??{\d+}?? bytes (~???%, error <= ??{\d+}?? bytes)
+//! ???
@@ -0,0 +1,25 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Sampling mode (M61_SAMPLE) still counts every allocation in the
+// statistics, and still catches double frees of unsampled pointers.
+
+int main() {
+    setenv("M61_SAMPLE", "4096", 1);
+    void* ptrs[1000];
+    for (int i = 0; i != 1000; ++i) {
+        ptrs[i] = malloc(10);
+    }
+    for (int i = 0; i != 500; ++i) {
+        free(ptrs[i]);
+    }
+    m61_print_statistics();
+    fflush(stdout);
+    free(ptrs[1]);
+}
+
+//! alloc count: active        500   total       1000   fail          0
+//! alloc size:  active       5000   total      10000   fail          0
+//! MEMORY BUG???: invalid free of pointer ???, double free
+//! ???
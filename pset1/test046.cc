@@ -0,0 +1,35 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <cstdlib>
+// Grow a buffer with realloc one byte at a time up to 64 KiB.
+// Most calls must grow the buffer in place.
+
+int main() {
+    // guarded blocks are separate mappings and always move
+    unsetenv("M61_GUARD");
+    const size_t limit = 64 << 10;
+    char* buf = nullptr;
+    size_t nmoves = 0;
+    for (size_t sz = 1; sz <= limit; ++sz) {
+        char* next = (char*) m61_realloc(buf, sz, __FILE__, __LINE__);
+        nmoves += next != buf;
+        buf = next;
+        buf[sz - 1] = (char) sz;
+    }
+    for (size_t i = 0; i < limit; ++i) {
+        assert(buf[i] == (char) (i + 1));
+    }
+    // capacities grow by a quarter at a time, so the buffer moves about
+    // 50 times on the way to 64 KiB
+    assert(nmoves < 100);
+    m61_print_statistics();
+    free(buf);
+    m61_print_statistics();
+}
+
+//! alloc count: active          1   total      65536   fail          0
+//! alloc size:  active      65536   total 2147516416   fail          0
+//! alloc count: active          0   total      65536   fail          0
+//! alloc size:  active          0   total 2147516416   fail          0
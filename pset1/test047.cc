@@ -0,0 +1,17 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Invalid free far inside a large block, found through the page map.
+
+int main() {
+    char* small = (char*) malloc(100);
+    char* ptr = (char*) malloc(100000);
+    free(ptr + 65536);
+    free(small);
+    m61_print_statistics();
+}
+
+//! MEMORY BUG: test???.cc:10: invalid free of pointer ???, not allocated
+//!   test???.cc:9: ??? is 65536 bytes inside a 100000 byte region allocated here
+//! ???
@@ -0,0 +1,22 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <cstdint>
+// Invalid free of a pointer in the heap range where no block ever was. The
+// slab region and the base heap are far apart, and the memory in between
+// must not be read.
+
+int main() {
+    setenv("M61_SLAB", "1", 1);
+    uintptr_t small = (uintptr_t) malloc(100);
+    uintptr_t large = (uintptr_t) malloc(100000);
+    uintptr_t middle = (small / 2 + large / 2) & ~(uintptr_t) 15;
+    fprintf(stderr, "Will free %p\n", (void*) middle);
+    free((void*) middle);
+    m61_print_statistics();
+}
+
+//! Will free ??{0x\w+}=ptr??
+//! MEMORY BUG: test???.cc:16: invalid free of pointer ??ptr??, not allocated
+//! ???
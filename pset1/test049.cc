@@ -0,0 +1,54 @@
+#include "m61.hh"
+#include "m61trace.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+// Trace mode: every operation is appended to the trace file.
+
+int main() {
+    char filename[100];
+    snprintf(filename, sizeof(filename), "/tmp/test049-%d.trace", (int) getpid());
+    setenv("M61_TRACE", filename, 1);
+    setenv("M61_TRACE_RECORDS", "4", 1);
+
+    void* ptrs[6];
+    for (int i = 0; i != 6; ++i) {
+        ptrs[i] = malloc(i + 10);
+    }
+    free(ptrs[2]);
+    free(ptrs[4]);
+
+    int fd = open(filename, O_RDONLY);
+    assert(fd >= 0);
+    size_t filesz = M61_TRACE_HEADER_SIZE + M61_TRACE_NSITES * sizeof(m61_trace_site)
+        + 4 * sizeof(m61_trace_record);
+    auto header = (const m61_trace_header*) mmap(nullptr, filesz, PROT_READ, MAP_SHARED, fd, 0);
+    assert(header != MAP_FAILED);
+    unlink(filename);
+    auto sites = (const m61_trace_site*) ((const char*) header + M61_TRACE_HEADER_SIZE);
+    auto records = (const m61_trace_record*) (sites + M61_TRACE_NSITES);
+
+    // the ring holds the last 4 of 8 records
+    printf("%llu records, %u sites\n", (unsigned long long) header->nrecords.load(),
+           header->nsites.load());
+    for (uint64_t i = 4; i != 8; ++i) {
+        const m61_trace_record& r = records[i % 4];
+        printf("%s %zu at %s:%ld\n", r.op == M61_TRACE_MALLOC ? "malloc" : "free",
+               (size_t) r.size, sites[r.site].file, (long) sites[r.site].line);
+        assert(r.ptr == (uintptr_t) ptrs[i == 7 ? 4 : i == 6 ? 2 : i]);
+    }
+    for (int i = 0; i != 6; ++i) {
+        if (i != 2 && i != 4) {
+            free(ptrs[i]);
+        }
+    }
+}
+
+//! 8 records, 3 sites
+//! malloc 14 at test049.cc:19
+//! malloc 15 at test049.cc:19
+//! free 12 at test049.cc:21
+//! free 14 at test049.cc:22
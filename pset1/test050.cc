@@ -0,0 +1,34 @@
+#include "m61.hh"
+#include "m61stats.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Peak active size, size histogram and active bytes per site.
+
+int main() {
+    void* big = malloc(5000);
+    void* ptrs[10];
+    for (int i = 0; i != 10; ++i) {
+        ptrs[i] = malloc(i * 10);
+    }
+    free(big);
+    for (int i = 0; i != 5; ++i) {
+        free(ptrs[i]);
+    }
+    ptrs[9] = realloc(ptrs[9], 100);
+
+    m61_extra_statistics stats;
+    m61_get_extra_statistics(&stats);
+    assert(stats.peak_active_size == 5450);
+    m61_print_extra_statistics();
+}
+
+//! peak active size: 5450 bytes at ???s
+//! alloc size          0-0                   1
+//! alloc size          8-15                  1
+//! alloc size         16-31                  2
+//! alloc size         32-63                  3
+//! alloc size         64-127                 4
+//! alloc size       4096-8191                1
+//! ACTIVE SITE: test050.cc:12: 260 bytes in 4 pointers
+//! ACTIVE SITE: test050.cc:18: 100 bytes in 1 pointers
@@ -0,0 +1,30 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// The base allocator reuses freed memory, but not too soon.
+
+int main() {
+    char* ptrs[100];
+    for (int i = 0; i != 100; ++i) {
+        ptrs[i] = (char*) malloc(40);
+    }
+    for (int i = 0; i != 100; ++i) {
+        free(ptrs[i]);
+    }
+
+    // the 64 most recently freed blocks stay untouched
+    int reused = 0;
+    for (int j = 0; j != 30; ++j) {
+        char* p = (char*) malloc(40);
+        for (int i = 0; i != 100; ++i) {
+            if (p == ptrs[i]) {
+                assert(i < 100 - 64);
+                ++reused;
+            }
+        }
+    }
+    printf("reused %d\n", reused);
+}
+
+//! reused 30
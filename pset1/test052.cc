@@ -0,0 +1,30 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+// Guard mode: writing past the end of a block traps right away.
+
+static volatile int offset;
+
+static void handler(int) {
+    char buf[100];
+    int n = snprintf(buf, sizeof(buf), "overflow trapped at byte %d\n", offset);
+    ssize_t w = write(STDOUT_FILENO, buf, n);
+    (void) w;
+    _exit(0);
+}
+
+int main() {
+    setenv("M61_GUARD", "1", 1);
+    signal(SIGSEGV, handler);
+    char* ptr = (char*) malloc(100);
+    for (int i = 0; i != 4096; ++i) {
+        offset = i;
+        ptr[i] = 'A';
+    }
+    printf("no trap\n");
+}
+
+//! overflow trapped at byte 112
@@ -0,0 +1,18 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// With M61_REDZONE, writes just before an allocated block are caught too.
+
+int main() {
+    setenv("M61_REDZONE", "32", 1);
+    char* ptr = (char*) malloc(100);
+    fprintf(stderr, "Will free %p\n", ptr);
+    ptr[-20] = 'A';
+    free(ptr);
+    m61_print_statistics();
+}
+
+//! Will free ??{0x\w+}=ptr??
+//! MEMORY BUG???: detected wild write during free of pointer ??ptr??
+//! ???
@@ -0,0 +1,23 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// With M61_QUARANTINE, a write to a freed pointer is caught when the block
+// leaves the quarantine, and reported with where it was freed.
+
+int main() {
+    setenv("M61_QUARANTINE", "4096", 1);
+    char* ptr = (char*) malloc(100);
+    fprintf(stderr, "Will free %p\n", ptr);
+    free(ptr);
+    ptr[10] = 'A';
+    for (int i = 0; i != 100; ++i) {
+        free(malloc(100));
+    }
+    m61_print_statistics();
+}
+
+//! Will free ??{0x\w+}=ptr??
+//! MEMORY BUG: detected write to freed pointer ??ptr??
+//! test???.cc:12: ??{0x\w+}?? is 10 bytes inside a 100 byte region freed here
+//! ???
@@ -0,0 +1,25 @@
+#include "m61.hh"
+#include "m61site.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// With m61site.hh, call sites pass ids, and reports still name them by
+// file and line.
+
+int main() {
+    for (int i = 0; i != 1000; ++i) {
+        void* ptr = malloc(300);
+        free(ptr);
+        ptr = calloc(10, 20);
+        ptr = realloc(ptr, 100);
+        free(ptr);
+    }
+    m61_print_statistics();
+    m61_print_heavy_hitter_report();
+}
+
+//! alloc count: active          0   total       3000   fail          0
+//! alloc size:  active          0   total     600000   fail          0
+//! HEAVY HITTER: test055.cc:11: 300000 bytes (~50.0%)
+//! HEAVY HITTER: test055.cc:13: 200000 bytes (~33.3%)
+//! HEAVY HITTER: test055.cc:14: 100000 bytes (~16.7%)
@@ -0,0 +1,42 @@
+#include "m61.hh"
+#include "m61stats.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <cstdlib>
+// The fragmentation report walks the active blocks in address order.
+
+int main() {
+    // guarded blocks each have pages of their own, so there are no gaps
+    unsetenv("M61_GUARD");
+    void* ptrs[256];
+    for (int i = 0; i != 256; ++i) {
+        ptrs[i] = malloc(1000);
+    }
+    m61_fragmentation_statistics before;
+    m61_get_fragmentation_statistics(&before);
+    assert(before.nblocks == 256);
+    assert(before.block_size >= 256 * 1000);
+
+    // free every other block: half the bytes become small gaps
+    for (int i = 0; i != 256; i += 2) {
+        free(ptrs[i]);
+    }
+    m61_fragmentation_statistics after;
+    m61_get_fragmentation_statistics(&after);
+    assert(after.nblocks == 128);
+    assert(after.block_size == before.block_size / 2);
+    assert(after.ngaps >= 127);
+    assert(after.fragmentation > 0.9);
+    assert(after.npages + after.nempty_pages == before.npages + before.nempty_pages);
+    assert(after.nreleasable_pages > before.nreleasable_pages);
+
+    m61_print_fragmentation_report(true);
+}
+
+//! heap blocks: 128 (??? bytes) in ??? regions
+//! heap gaps:   ??? bytes), largest ??? bytes, fragmentation 0.99???
+//! ???
+//! HEAP MAP: 1 page per character
+//! HEAP MAP: 0x??? |???|
+//! ???
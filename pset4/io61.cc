@@ -1,14 +1,71 @@
 #include "io61.hh"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <climits>
 #include <cerrno>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
 
 // io61.c
 //    YOUR CODE HERE!
 
 const size_t BUFSIZE = 4096;
 
+// The number of cache slots per file, each holding one aligned block
+#ifndef IO61_NSLOTS
+#define IO61_NSLOTS 64
+#endif
+
+// Read-only regular files up to this size are mapped into memory instead
+// of cached in slots (0 turns mapping off)
+#ifndef IO61_MAP_MAX
+#define IO61_MAP_MAX (uint64_t(1) << 40)
+#endif
+
+// Accesses at most this far apart count as walking through the file
+const off_t NEAR = 64 << 10;
+// The access pattern changes once this many accesses in a row call for it
+const int VOTES = 4;
+// The readahead window starts at RA_MIN blocks and doubles on every miss
+// that follows the pattern, up to half the slots but at least one (cached
+// reads) or RA_MAP_MAX (prefetching a mapping)
+const size_t RA_MAX = std::max<size_t>(IO61_NSLOTS / 2, 1);
+const size_t RA_MIN = std::min<size_t>(2, RA_MAX);
+const size_t RA_MAP_MAX = 256;
+
+
+// io61_pattern
+//    How a file is being read, judging by where accesses land.
+enum io61_pattern {
+    PATTERN_SEQUENTIAL,         // Forward, in small steps
+    PATTERN_REVERSE,            // Backward, in small steps
+    PATTERN_STRIDE,             // Repeated equal jumps
+    PATTERN_RANDOM
+};
+
+
+// io61_slot
+//    One cached block of a file.
+struct io61_slot {
+    off_t tag;                  // The physical position in the file
+                                // where the block begins, or -1 if unused
+
+    size_t length;              // The valid length of a block read from
+                                // the file; short at end of file
+
+    bool referenced;            // Used since the clock hand last passed
+
+    bool dirty;                 // Some bytes were written but not flushed
+
+    uint64_t dirty_bits[BUFSIZE / 64];  // Which bytes those are
+
+    char buf[BUFSIZE];          // The cached data
+};
+
+
 // io61_file
 //    Data structure for io61 file wrappers. Add your own stuff.
 struct io61_file {
@@ -16,16 +73,50 @@ struct io61_file {
 
     int mode;                   // The mode (premission) of the file
 
-    char buf[BUFSIZE];          // The cache with size 4096
+    bool seekable;              // If true, blocks are read and written at
+                                // their own positions with pread/pwrite.
+                                // If not (pipes, and files opened with
+                                // O_APPEND), slots[0] buffers the stream
+                                // in order.
+
+    bool append;                // Opened with O_APPEND: written in order
+                                // like a stream, but can still seek
+
+    off_t pos;                  // The current position in the file
+
+    io61_slot* curr;            // The slot last used, checked first
+
+    io61_slot slots[IO61_NSLOTS];
+
+    size_t hand;                // The clock hand: next slot to consider
+                                // for eviction
+
+    std::unordered_map<off_t, io61_slot*> index;  // Block position -> slot
+
+    const char* map;            // The whole file, if it is mapped: then
+                                // reads copy from here and skip the slots
+
+    size_t map_size;            // The mapped length
+
+    off_t map_prefetched;       // Start of the range a backward walk
+                                // has already asked the kernel for
+
+    io61_pattern pattern;       // The access pattern in effect
+
+    io61_pattern next_pattern;  // The pattern recent accesses call for,
+    int votes;                  // and how many in a row did
 
-    size_t cache_curr_pos;      // The current working position in cache
-                                // relative to the beginning of cache
+    off_t last_access;          // Where the last access landed: a seek
+                                // in a mapping, else a move to a block
 
-    size_t cache_valid_length;  // The valid length of cache
-                                // relative to the beginning of cache
+    off_t last_delta;           // How far that was from the one before
 
-    size_t file_tag;            // The physical position in the file
-                                // where the beginning of cache is aligned to
+    int stride_run;             // Accesses in a row `last_delta` apart
+
+    int stride_columns;         // The longest such run so far, plus one:
+                                // how many blocks a stride cycles through
+
+    size_t ra_window;           // Blocks to read at the next slot miss
 };
 
 
@@ -39,9 +130,51 @@ io61_file* io61_fdopen(int fd, int mode) {
     io61_file* f = new io61_file;
     f->fd = fd;
     f->mode = mode;
-    f->cache_curr_pos = 0;
-    f->cache_valid_length = 0;
-    f->file_tag = 0;
+    f->pos = lseek(fd, 0, SEEK_CUR);
+    // The kernel puts every write to an O_APPEND file at its end, pwrite
+    // too, so blocks must go out in order, like on a pipe
+    int flags = fcntl(fd, F_GETFL);
+    f->append = f->pos != -1 && mode != O_RDONLY
+        && flags != -1 && (flags & O_APPEND);
+    f->seekable = f->pos != -1 && !f->append;
+    if (f->pos == -1) {
+        f->pos = 0;
+    }
+    for (io61_slot& s : f->slots) {
+        s.tag = -1;
+        s.length = 0;
+        s.referenced = false;
+        s.dirty = false;
+        memset(s.dirty_bits, 0, sizeof(s.dirty_bits));
+    }
+    if (!f->seekable) {
+        f->slots[0].tag = f->pos;
+    }
+    f->curr = nullptr;
+    f->hand = 0;
+    f->pattern = f->next_pattern = PATTERN_SEQUENTIAL;
+    f->votes = 0;
+    f->last_access = f->pos;
+    f->last_delta = 0;
+    f->stride_run = 0;
+    f->stride_columns = 1;
+    f->ra_window = RA_MIN;
+
+    // Map read-only regular files; pipes, empty files, and files too
+    // large to map use the slots
+    f->map = nullptr;
+    struct stat s;
+    if (mode == O_RDONLY && fstat(fd, &s) == 0 && S_ISREG(s.st_mode)
+        && s.st_size > 0 && uint64_t(s.st_size) <= IO61_MAP_MAX
+        && uint64_t(s.st_size) <= SIZE_MAX) {
+        void* p = mmap(nullptr, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            f->map = (const char*) p;
+            f->map_size = s.st_size;
+            f->map_prefetched = f->map_size;
+            madvise(p, f->map_size, MADV_SEQUENTIAL);
+        }
+    }
     return f;
 }
 
@@ -51,6 +184,14 @@ io61_file* io61_fdopen(int fd, int mode) {
 
 int io61_close(io61_file* f) {
     io61_flush(f);
+    // Leave the file descriptor where the caller left off; pread and
+    // pwrite did not move it
+    if (f->seekable) {
+        lseek(f->fd, f->pos, SEEK_SET);
+    }
+    if (f->map) {
+        munmap((void*) f->map, f->map_size);
+    }
     int r = close(f->fd);
     delete f;
     return r;
@@ -62,6 +203,12 @@ int io61_close(io61_file* f) {
 //    (which is -1) on error or end-of-file.
 
 int io61_readc(io61_file* f) {
+    if (f->map) {
+        if (size_t(f->pos) < f->map_size) {
+            return (unsigned char) f->map[f->pos++];
+        }
+        return EOF;
+    }
     unsigned char cbuf[1];
     ssize_t status = io61_read(f, (char*) cbuf, 1);
     if (status == 1) {
@@ -72,117 +219,409 @@ int io61_readc(io61_file* f) {
 }
 
 
-// fill_cache(f)
-//     Read up to BUFSIZE bytes from an aligned block in 'f' into the cache.
-//     Return the number of new bytes actually read, which might be
-//     BUFSIZE or a short count.
+// read_fully(f, buf, sz, pos)
+//    Read up to `sz` bytes at position `pos` of `f` into `buf`. Reads
+//    until `sz` bytes or end of file from a seekable file, but only what
+//    one read returns from a stream. Returns the number of bytes read,
+//    or -1 on error.
+
+static ssize_t read_fully(io61_file* f, char* buf, size_t sz, off_t pos) {
+    size_t nread = 0;
+    while (nread < sz) {
+        ssize_t status;
+        if (f->seekable) {
+            status = pread(f->fd, &buf[nread], sz - nread, pos + nread);
+        } else {
+            status = read(f->fd, &buf[nread], sz - nread);
+        }
+        if (status == -1 && errno == EINTR) {
+            continue;
+        }
+        if (status == -1) return -1;
+        nread += status;
+        if (status == 0 || !f->seekable) {
+            break;
+        }
+    }
+    return nread;
+}
 
-ssize_t fill_cache(io61_file* f) {
 
-    lseek(f->fd, f->file_tag, SEEK_SET);  // Make fp points to aligned block
+// write_fully(f, buf, sz, pos)
+//    Write the `sz` bytes at `buf` to position `pos` of `f` (or to the
+//    end of a stream). Returns 0 on success or -1 on error.
 
-    size_t nread = 0;  // Counts number of bytes read
-    while (nread < BUFSIZE) {
+static int write_fully(io61_file* f, const char* buf, size_t sz, off_t pos) {
+    size_t nwritten = 0;
+    while (nwritten < sz) {
+        ssize_t status;
+        if (f->seekable) {
+            status = pwrite(f->fd, &buf[nwritten], sz - nwritten, pos + nwritten);
+        } else {
+            status = write(f->fd, &buf[nwritten], sz - nwritten);
+        }
+        if (status == -1 && errno == EINTR) {
+            continue;
+        }
+        if (status == -1) return -1;
+        nwritten += status;
+    }
+    return 0;
+}
 
-        // Read from file into cache with needed size
-        ssize_t status = read(f->fd, &f->buf[nread], BUFSIZE - nread);
 
-        // If error occurred on read, return -1
-        if (status == -1) return -1;
+// find_dirty_bit(s, i, value)
+//    Return the first byte offset `>= i` in slot `s` whose dirty bit is
+//    `value`, or BUFSIZE if there is none.
 
-        // If reach EOF, return short count
-        if (status == 0) {
-            f->cache_valid_length = nread;  // Cache now filled with nread bytes
-            lseek(f->fd, f->file_tag + f->cache_curr_pos, SEEK_SET);  // Reset fp
-            return nread;
+static size_t find_dirty_bit(const io61_slot* s, size_t i, bool value) {
+    while (i < BUFSIZE) {
+        uint64_t word = value ? s->dirty_bits[i / 64] : ~s->dirty_bits[i / 64];
+        word &= ~uint64_t(0) << (i % 64);
+        if (word) {
+            return i / 64 * 64 + __builtin_ctzll(word);
         }
-        nread += status;
+        i = (i / 64 + 1) * 64;
     }
+    return BUFSIZE;
+}
 
-    lseek(f->fd, f->file_tag + f->cache_curr_pos, SEEK_SET);  // Reset fp
 
-    f->cache_valid_length = BUFSIZE;  // Cache now filled with sz bytes
+// mark_dirty(s, begin, end)
+//    Mark bytes [begin, end) of slot `s` as written.
 
-    return BUFSIZE;
+static void mark_dirty(io61_slot* s, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ) {
+        size_t n = std::min(end - i, 64 - i % 64);
+        uint64_t mask = n == 64 ? ~uint64_t(0) : ((uint64_t(1) << n) - 1);
+        s->dirty_bits[i / 64] |= mask << (i % 64);
+        i += n;
+    }
+    s->dirty = true;
 }
 
 
-// io61_read(f, buf, sz)
-//    Read up to `sz` characters from `f` into `buf`. Returns the number of
-//    characters read on success; normally this is `sz`. Returns a short
-//    count, which might be zero, if the file ended before `sz` characters
-//    could be read. Returns -1 if an error occurred before any characters
-//    were read.
+// flush_slot(f, s)
+//    Write each run of dirty bytes in slot `s` to the file. Returns 0 on
+//    success or -1 on error.
+
+static int flush_slot(io61_file* f, io61_slot* s) {
+    if (!s->dirty) {
+        return 0;
+    }
+    size_t end = 0;
+    while (true) {
+        size_t begin = find_dirty_bit(s, end, true);
+        if (begin == BUFSIZE) {
+            break;
+        }
+        end = find_dirty_bit(s, begin, false);
+        if (write_fully(f, &s->buf[begin], end - begin, s->tag + begin) == -1) {
+            return -1;
+        }
+    }
+    memset(s->dirty_bits, 0, sizeof(s->dirty_bits));
+    s->dirty = false;
+    return 0;
+}
 
-ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
 
-    // If cache is empty, fill cache
-    if (f->cache_valid_length == 0) {
-      fill_cache(f);
+// drop_slot(f, tag)
+//    Forget the cached block at position `tag`, if any, including its
+//    unflushed writes.
+
+static void drop_slot(io61_file* f, off_t tag) {
+    auto it = f->index.find(tag);
+    if (it == f->index.end()) {
+        return;
+    }
+    io61_slot* s = it->second;
+    f->index.erase(it);
+    s->tag = -1;
+    s->dirty = false;
+    memset(s->dirty_bits, 0, sizeof(s->dirty_bits));
+    if (f->curr == s) {
+        f->curr = nullptr;
     }
+}
 
-    size_t cache_remaining_length = f->cache_valid_length - f->cache_curr_pos;
 
-    // If cache's remaining data is enough, read from cache
-    if (cache_remaining_length >= sz) {
-        memcpy(buf, &f->buf[f->cache_curr_pos], sz);
-        f->cache_curr_pos += sz;
-        return sz;
+// evict_slot(f)
+//    Choose a slot to reuse with the clock algorithm: the hand skips, and
+//    clears, slots referenced since it last passed. Flushes the chosen
+//    slot and returns it, unused. Returns nullptr if the flush failed.
+
+static io61_slot* evict_slot(io61_file* f) {
+    while (true) {
+        io61_slot* s = &f->slots[f->hand];
+        f->hand = (f->hand + 1) % IO61_NSLOTS;
+        if (s->tag == -1) {
+            return s;
+        } else if (s->referenced) {
+            s->referenced = false;
+        } else {
+            if (flush_slot(f, s) == -1) {
+                return nullptr;
+            }
+            f->index.erase(s->tag);
+            s->tag = -1;
+            if (f->curr == s) {
+                f->curr = nullptr;
+            }
+            return s;
+        }
     }
+}
 
-    // If cache's remaining data is not enough
-    else {
 
-        // Read the remaining data and deplete cache
-        memcpy(buf, &f->buf[f->cache_curr_pos], cache_remaining_length);
-        buf += cache_remaining_length;
+// set_pattern(f, pattern)
+//    Switch `f` to a new access pattern. A mapping gets the matching
+//    madvise hint: the kernel reads ahead only forwards, so a reverse walk
+//    or a stride leaves the kernel's default read-around in place, and
+//    random access turns readahead off.
+
+static void set_pattern(io61_file* f, io61_pattern pattern) {
+    f->pattern = pattern;
+    f->votes = 0;
+    f->ra_window = RA_MIN;
+    if (f->map) {
+        int advice = MADV_NORMAL;
+        if (pattern == PATTERN_SEQUENTIAL) {
+            advice = MADV_SEQUENTIAL;
+        } else if (pattern == PATTERN_RANDOM) {
+            advice = MADV_RANDOM;
+        }
+        madvise((void*) f->map, f->map_size, advice);
+        f->map_prefetched = f->map_size;
+    }
+}
 
-        // Then read more
-        size_t needed_to_read = sz - cache_remaining_length;
 
-        // If cache can incorporate what is needed, fill cache and read from it
-        if (needed_to_read <= BUFSIZE) {
+// observe_access(f, pos)
+//    Update the access pattern of `f` with an access at `pos`. Short
+//    steps forward or back are sequential or reverse; a far jump is part
+//    of a stride if it repeats the one before. The pattern changes only
+//    once VOTES accesses in a row agree.
+
+static void observe_access(io61_file* f, off_t pos) {
+    off_t delta = pos - f->last_access;
+    f->stride_run = delta == f->last_delta ? f->stride_run + 1 : 1;
+    f->last_access = pos;
+    f->last_delta = delta;
+
+    io61_pattern pattern;
+    if (delta > 0 && delta <= NEAR) {
+        pattern = PATTERN_SEQUENTIAL;
+    } else if (delta < 0 && delta >= -NEAR) {
+        pattern = PATTERN_REVERSE;
+    } else if (f->stride_run >= 2) {
+        pattern = PATTERN_STRIDE;
+        f->stride_columns = std::max(f->stride_columns, f->stride_run + 1);
+    } else {
+        pattern = PATTERN_RANDOM;
+    }
 
-            f->file_tag += BUFSIZE;  // Update physical position of cache
-            int n = fill_cache(f);
+    if (pattern == f->pattern) {
+        f->votes = 0;
+    } else if (pattern != f->next_pattern) {
+        f->next_pattern = pattern;
+        f->votes = 1;
+    } else if (++f->votes >= VOTES) {
+        set_pattern(f, pattern);
+    }
+}
 
-            if (n == -1) return -1;
 
-            else {
-                // min = min(needed_to_read, n) !!
-                ssize_t min = n < (int)needed_to_read ? n : needed_to_read;
+// read_blocks(f, tag, n)
+//    Read the `n` blocks starting at position `tag` into fresh slots with
+//    one system call. Returns the slot for the first block, or nullptr on
+//    error. Blocks past end of file are cached as empty.
+
+static io61_slot* read_blocks(io61_file* f, off_t tag, size_t n) {
+    assert(n > 0 && n <= IO61_NSLOTS);
+    io61_slot* slots[IO61_NSLOTS];
+    struct iovec iov[IO61_NSLOTS];
+    for (size_t i = 0; i < n; ++i) {
+        // The clock hand has just passed the slots claimed so far, so it
+        // reaches every other slot before coming back to them
+        slots[i] = evict_slot(f);
+        if (!slots[i]) {
+            for (size_t j = 0; j < i; ++j) {
+                drop_slot(f, slots[j]->tag);
+            }
+            return nullptr;
+        }
+        slots[i]->tag = tag + i * BUFSIZE;
+        slots[i]->length = 0;
+        slots[i]->referenced = true;
+        f->index[slots[i]->tag] = slots[i];
+        iov[i].iov_base = slots[i]->buf;
+        iov[i].iov_len = BUFSIZE;
+    }
 
-                // Move needed data from cache into buf
-                memcpy(buf, f->buf, min);
+    ssize_t nread;
+    do {
+        nread = preadv(f->fd, iov, n, tag);
+    } while (nread == -1 && errno == EINTR);
+    if (nread == -1) {
+        for (size_t i = 0; i < n; ++i) {
+            drop_slot(f, slots[i]->tag);
+        }
+        return nullptr;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        size_t off = i * BUFSIZE;
+        slots[i]->length = size_t(nread) > off ? std::min(nread - off, BUFSIZE) : 0;
+    }
+    return slots[0];
+}
 
-                f->cache_curr_pos = min;
 
-                return cache_remaining_length + min;  // Return total size read
-            }
+// read_ahead(f, tag)
+//    Load the block at `tag`, which is not cached, along with the blocks
+//    the access pattern predicts: the ones after it when reading forward
+//    or by stride (each point of a stride tends to be read onward), or
+//    the ones before it in reverse. Stops at blocks already cached. Grows
+//    the window for next time. Returns the slot for `tag`, or nullptr on
+//    error.
+
+static io61_slot* read_ahead(io61_file* f, off_t tag) {
+    size_t window = 1;
+    if (f->pattern == PATTERN_STRIDE) {
+        // leave room for a block at every point of the stride
+        size_t share = IO61_NSLOTS / (2 * f->stride_columns);
+        window = std::max(std::min(f->ra_window, share), size_t(1));
+    } else if (f->pattern != PATTERN_RANDOM) {
+        window = f->ra_window;
+    }
+    // `ra_window` may have grown past RA_MAX while prefetching a mapping
+    window = std::min(window, RA_MAX);
+
+    off_t first = tag;
+    size_t n = 1;
+    if (f->pattern == PATTERN_REVERSE) {
+        while (n < window && first >= off_t(BUFSIZE)
+               && !f->index.count(first - BUFSIZE)) {
+            first -= BUFSIZE;
+            ++n;
         }
+    } else {
+        while (n < window && !f->index.count(tag + n * BUFSIZE)) {
+            ++n;
+        }
+    }
+    f->ra_window = std::min(f->ra_window * 2, RA_MAX);
+
+    if (!read_blocks(f, first, n)) return nullptr;
+    return f->index.find(tag)->second;
+}
 
-        // If cache cannot incorporate what is needed, read from file directly
-        else {
-            f->cache_valid_length = 0;
-            f->cache_curr_pos = (sz - cache_remaining_length) % BUFSIZE;
-            f->file_tag = (f->file_tag + BUFSIZE + sz - cache_remaining_length) / BUFSIZE * BUFSIZE;
-            size_t nread = 0;
 
-            while (nread < needed_to_read) {
-                ssize_t status = read(f->fd, &buf[nread], needed_to_read - nread);
+// find_slot(f)
+//    Return the slot that holds the current position of `f`, filling
+//    it from the file if `f` is read-only. Returns nullptr on error.
+
+static io61_slot* find_slot(io61_file* f) {
+    // A stream uses one slot, which starts wherever the stream was
+    if (!f->seekable) {
+        io61_slot* s = &f->slots[0];
+        size_t off = f->pos - s->tag;
+        if (f->mode == O_RDONLY && off >= s->length) {
+            ssize_t n = read_fully(f, s->buf, BUFSIZE, f->pos);
+            if (n == -1) return nullptr;
+            s->tag = f->pos;
+            s->length = n;
+        } else if (f->mode != O_RDONLY && off >= BUFSIZE) {
+            if (flush_slot(f, s) == -1) return nullptr;
+            s->tag = f->pos;
+        }
+        return s;
+    }
 
-                // If error occurred on read, return -1
-                if (status == -1) return -1;
+    off_t tag = f->pos - f->pos % BUFSIZE;
+    if (f->curr && f->curr->tag == tag) {
+        return f->curr;
+    }
 
-                // If reach EOF
-                if (status == 0) {
-                    return cache_remaining_length + nread;
-                }
-                nread += status;
+    if (f->mode == O_RDONLY) {
+        observe_access(f, tag);
+    }
+
+    io61_slot* s;
+    auto it = f->index.find(tag);
+    if (it != f->index.end()) {
+        s = it->second;
+    } else if (f->mode == O_RDONLY) {
+        s = read_ahead(f, tag);
+        if (!s) return nullptr;
+    } else {
+        s = evict_slot(f);
+        if (!s) return nullptr;
+        s->length = 0;
+        s->tag = tag;
+        f->index[tag] = s;
+    }
+    s->referenced = true;
+    f->curr = s;
+    return s;
+}
+
+
+// io61_read(f, buf, sz)
+//    Read up to `sz` characters from `f` into `buf`. Returns the number of
+//    characters read on success; normally this is `sz`. Returns a short
+//    count, which might be zero, if the file ended before `sz` characters
+//    could be read. Returns -1 if an error occurred before any characters
+//    were read.
+
+ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
+    if (f->map) {
+        size_t n = 0;
+        if (size_t(f->pos) < f->map_size) {
+            n = std::min(sz, f->map_size - f->pos);
+            memcpy(buf, &f->map[f->pos], n);
+            f->pos += n;
+        }
+        return n;
+    }
+
+    size_t nread = 0;
+    while (nread < sz) {
+        size_t remaining = sz - nread;
+
+        // Whole blocks are read straight into `buf`, unless cached
+        bool cached = f->seekable
+            ? f->index.count(f->pos) != 0
+            : size_t(f->pos - f->slots[0].tag) < f->slots[0].length;
+        if (remaining >= BUFSIZE && !cached
+            && (!f->seekable || f->pos % BUFSIZE == 0)) {
+            size_t want = f->seekable ? remaining / BUFSIZE * BUFSIZE : remaining;
+            ssize_t n = read_fully(f, &buf[nread], want, f->pos);
+            if (n == -1) {
+                return nread ? ssize_t(nread) : -1;
             }
-            return sz;
+            nread += n;
+            f->pos += n;
+            if (n == 0) {
+                break;
+            }
+            continue;
+        }
+
+        io61_slot* s = find_slot(f);
+        if (!s) {
+            return nread ? ssize_t(nread) : -1;
+        }
+        size_t off = f->pos - s->tag;
+        if (off >= s->length) {
+            break;  // End of file
         }
+        size_t n = std::min(remaining, s->length - off);
+        memcpy(&buf[nread], &s->buf[off], n);
+        nread += n;
+        f->pos += n;
     }
+    return nread;
 }
 
 // io61_writec(f)
@@ -207,45 +646,44 @@ int io61_writec(io61_file* f, int ch) {
 //    an error occurred before any characters were written.
 
 ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
-
-    size_t cache_available_space = BUFSIZE - f->cache_curr_pos;
-
-    // If cache's available space is enough, write into cache
-    if (cache_available_space >= sz) {
-
-        memcpy(&f->buf[f->cache_curr_pos], buf, sz);
-
-        // max(cache_valid_length, cache_curr_pos + sz);
-        size_t max = f->cache_valid_length > (f->cache_curr_pos + sz) ? f->cache_valid_length : (f->cache_curr_pos + sz);
-
-        f->cache_valid_length = max;
-
-        f->cache_curr_pos += sz;
-
-        return sz;
-    }
-
-    // If cache's available space is not enough
-    else {
-
-        io61_flush(f);
-
-        size_t nwritten = 0;  // Counts number of bytes written
-
-        while (nwritten < sz) {
-
-            ssize_t status = write(f->fd, &buf[nwritten], sz - nwritten);
-
-            // If error occurred, return -1
-            if (status == -1) return -1;
-
-            nwritten += status;
+    size_t nwritten = 0;
+    while (nwritten < sz) {
+        size_t remaining = sz - nwritten;
+
+        // Whole blocks go straight to the file, replacing cached copies
+        if (remaining >= BUFSIZE
+            && (!f->seekable || f->pos % BUFSIZE == 0)) {
+            size_t n = f->seekable ? remaining / BUFSIZE * BUFSIZE : remaining;
+            if (f->seekable) {
+                for (size_t i = 0; !f->index.empty() && i < n; i += BUFSIZE) {
+                    drop_slot(f, f->pos + i);
+                }
+            } else if (flush_slot(f, &f->slots[0]) == -1) {
+                return nwritten ? ssize_t(nwritten) : -1;
+            }
+            if (write_fully(f, &buf[nwritten], n, f->pos) == -1) {
+                return nwritten ? ssize_t(nwritten) : -1;
+            }
+            nwritten += n;
+            f->pos += n;
+            if (!f->seekable) {
+                f->slots[0].tag = f->pos;
+            }
+            continue;
         }
 
-        f->file_tag = (f->file_tag + BUFSIZE + sz - cache_available_space) / BUFSIZE * BUFSIZE;
-
-        return sz;
+        io61_slot* s = find_slot(f);
+        if (!s) {
+            return nwritten ? ssize_t(nwritten) : -1;
+        }
+        size_t off = f->pos - s->tag;
+        size_t n = std::min(remaining, BUFSIZE - off);
+        memcpy(&s->buf[off], &buf[nwritten], n);
+        mark_dirty(s, off, off + n);
+        nwritten += n;
+        f->pos += n;
     }
+    return nwritten;
 }
 
 
@@ -260,22 +698,32 @@ int io61_flush(io61_file* f) {
         return 0;
     }
 
-    size_t nwritten = 0;
-
-    while (nwritten < f->cache_valid_length) {
+    int r = 0;
+    for (io61_slot& s : f->slots) {
+        if (flush_slot(f, &s) == -1) {
+            r = -1;
+        }
+    }
+    return r;
+}
 
-        ssize_t status = write(f->fd, &f->buf[nwritten], f->cache_valid_length - nwritten);
 
-        if (status == -1) return -1;
+// map_prefetch(f, pos)
+//    In a mapping walked in reverse, ask the kernel for the window below
+//    `pos` whenever `pos` leaves the range already asked for, since its
+//    own readahead only goes forwards. The window grows each time.
 
-        nwritten += status;
+static void map_prefetch(io61_file* f, off_t pos) {
+    if (f->pattern != PATTERN_REVERSE || pos >= f->map_prefetched) {
+        return;
     }
-
-    // Zero the current position and valid length
-    f->cache_curr_pos = 0;
-    f->cache_valid_length = 0;
-
-    return 0;
+    static const off_t pagesize = sysconf(_SC_PAGESIZE);
+    off_t window = f->ra_window * BUFSIZE;
+    off_t begin = std::max(pos - window, off_t(0)) / pagesize * pagesize;
+    off_t end = std::min(f->map_prefetched, pos + 1);
+    madvise((void*) &f->map[begin], end - begin, MADV_WILLNEED);
+    f->map_prefetched = begin;
+    f->ra_window = std::min(f->ra_window * 2, RA_MAP_MAX);
 }
 
 
@@ -285,33 +733,30 @@ int io61_flush(io61_file* f) {
 
 int io61_seek(io61_file* f, off_t pos) {
 
-    // If new position is within the cache, seek to the position
-    if ((size_t)pos >= f->file_tag
-        && (size_t)pos < (f->file_tag + f->cache_valid_length)) {
-
-        off_t r = lseek(f->fd, pos, SEEK_SET);
-
-        if (r == -1) return -1;
-
-        f->cache_curr_pos = pos - f->file_tag;
-
+    // An O_APPEND file takes the seek, as lseek does, though the kernel
+    // still appends whatever comes next: write out what came before, and
+    // buffer from `pos` on
+    if (f->append && pos >= 0) {
+        if (flush_slot(f, &f->slots[0]) == -1) {
+            return -1;
+        }
+        f->pos = f->slots[0].tag = pos;
         return 0;
     }
 
-    // If new position is outside the cache
-    else {
-        io61_flush(f);
-
-        f->file_tag = off_t(pos / BUFSIZE * BUFSIZE);
-
-        off_t r = lseek(f->fd, pos, SEEK_SET);
-        if (r == -1) return -1;
-
-        f->cache_curr_pos = pos % BUFSIZE;
-        f->cache_valid_length = 0;
+    // Streams cannot seek
+    if (!f->seekable || pos < 0) {
+        errno = f->seekable ? EINVAL : ESPIPE;
+        return -1;
+    }
 
-        return 0;
+    // Nothing else to do: blocks are read and written at their positions
+    if (f->map && pos != f->pos) {
+        observe_access(f, pos);
+        map_prefetch(f, pos);
     }
+    f->pos = pos;
+    return 0;
 }
 
 
@@ -0,0 +1,130 @@
+#include "io61.hh"
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <algorithm>
+#include <cerrno>
+
+// Usage: ./kernelcat61 [-s SIZE] [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE like cat61, but without io61: the
+//    kernel moves the data directly when the files allow it; otherwise it
+//    is copied through a large buffer. It shows how fast a copy can be,
+//    for comparison with cat61 and blockcat61.
+
+// Largest amount to ask the kernel to move in one system call.
+const size_t KERNEL_CHUNK = 1 << 30;
+// Size of the buffer for copies the kernel cannot do.
+const size_t BUFFER_SIZE = 1 << 20;
+
+
+// open_fd_check(filename, mode)
+//    Like io61_open_check, but return the file descriptor.
+
+static int open_fd_check(const char* filename, int mode) {
+    if (!filename) {
+        return (mode & O_ACCMODE) == O_RDONLY ? STDIN_FILENO : STDOUT_FILENO;
+    }
+    int fd = open(filename, mode, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    return fd;
+}
+
+
+// kernel_copy(infd, outfd, size)
+//    Copy up to `*size` bytes from `infd` to `outfd` without passing them
+//    through user space: with copy_file_range between regular files, with
+//    splice if either end is a pipe, and with sendfile from a regular file
+//    to anything else. Subtracts the bytes copied from `*size`. Returns
+//    true if the copy reached end of file or `*size`, and false if the
+//    kernel cannot copy the rest between these files.
+
+static bool kernel_copy(int infd, int outfd, size_t* size) {
+    struct stat ist, ost;
+    if (fstat(infd, &ist) < 0 || fstat(outfd, &ost) < 0) {
+        return false;
+    }
+    bool inreg = S_ISREG(ist.st_mode), outreg = S_ISREG(ost.st_mode);
+    bool pipe = S_ISFIFO(ist.st_mode) || S_ISFIFO(ost.st_mode);
+    // Files in /proc and /sys claim size 0, yet have contents that only
+    // read() produces.
+    if (inreg && ist.st_size == 0) {
+        return false;
+    }
+
+    while (*size > 0) {
+        size_t n = std::min(*size, KERNEL_CHUNK);
+        ssize_t r;
+        if (inreg && outreg) {
+            r = copy_file_range(infd, nullptr, outfd, nullptr, n, 0);
+        } else if (pipe) {
+            r = splice(infd, nullptr, outfd, nullptr, n,
+                       SPLICE_F_MOVE | SPLICE_F_MORE);
+        } else if (inreg) {
+            r = sendfile(outfd, infd, nullptr, n);
+        } else {
+            return false;
+        }
+        if (r > 0) {
+            *size -= r;
+        } else if (r == 0) {
+            return true;
+        } else if (errno != EINTR) {
+            // EINVAL, EXDEV, ENOSYS, ...: the buffered copy takes over
+            // from here, and reports any real error itself
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// buffer_copy(infd, outfd, size)
+//    Copy up to `size` bytes from `infd` to `outfd` through a page-aligned
+//    buffer. Exits with an error message on error.
+
+static void buffer_copy(int infd, int outfd, size_t size) {
+    char* buf = (char*) aligned_alloc(4096, BUFFER_SIZE);
+    if (!buf) {
+        perror("aligned_alloc");
+        exit(1);
+    }
+    while (size > 0) {
+        ssize_t nr = read(infd, buf, std::min(size, BUFFER_SIZE));
+        if (nr == 0) {
+            break;
+        } else if (nr < 0 && errno != EINTR) {
+            perror("read");
+            exit(1);
+        }
+        for (ssize_t nw = 0; nw < nr; ) {
+            ssize_t w = write(outfd, buf + nw, nr - nw);
+            if (w < 0 && errno != EINTR) {
+                perror("write");
+                exit(1);
+            }
+            nw += std::max(w, (ssize_t) 0);
+        }
+        size -= std::max(nr, (ssize_t) 0);
+    }
+    free(buf);
+}
+
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "s:o:i:");
+
+    io61_profile_begin();
+    int infd = open_fd_check(args.input_file, O_RDONLY);
+    int outfd = open_fd_check(args.output_file, O_WRONLY | O_CREAT | O_TRUNC);
+
+    if (!kernel_copy(infd, outfd, &args.input_size)) {
+        buffer_copy(infd, outfd, args.input_size);
+    }
+
+    close(infd);
+    close(outfd);
+    io61_profile_end();
+}
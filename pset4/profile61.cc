@@ -27,16 +27,28 @@ void io61_profile_end() {
     r = getrusage(RUSAGE_CHILDREN, &cusage);
     assert(r >= 0);
 
+    // Count the system calls that read or write data (read, pread,
+    // preadv, write, ...; not lseek or mmap), if the kernel keeps count
+    long syscr = -1, syscw = -1;
+    if (FILE* io = fopen("/proc/self/io", "r")) {
+        char line[100];
+        while (fgets(line, sizeof(line), io)) {
+            sscanf(line, "syscr: %ld", &syscr);
+            sscanf(line, "syscw: %ld", &syscw);
+        }
+        fclose(io);
+    }
+
     timersub(&tv_end, &tv_begin, &tv_end);
     timeradd(&usage.ru_utime, &cusage.ru_utime, &usage.ru_utime);
     timeradd(&usage.ru_stime, &cusage.ru_stime, &usage.ru_stime);
 
     char buf[1000];
-    int len = sprintf(buf, "{\"time\":%ld.%06ld, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld}\n",
+    int len = sprintf(buf, "{\"time\":%ld.%06ld, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld, \"syscr\":%ld, \"syscw\":%ld}\n",
                       tv_end.tv_sec, (long) tv_end.tv_usec,
                       usage.ru_utime.tv_sec, (long) usage.ru_utime.tv_usec,
                       usage.ru_stime.tv_sec, (long) usage.ru_stime.tv_usec,
-                      usage.ru_maxrss + cusage.ru_maxrss);
+                      usage.ru_maxrss + cusage.ru_maxrss, syscr, syscw);
 
     // Print the report to file descriptor 100 if it's available. Our
     // `check.pl` test harness uses this file descriptor.